@@ -0,0 +1,234 @@
+#include "arp_probe.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <net/if_arp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+enum probe_state {
+    PROBE_UNUSED = 0,
+    PROBE_PENDING,                   /* request sent, waiting for a reply until the timeout */
+    PROBE_FREE,                      /* nobody answered, address is in the warm pool */
+    PROBE_TAKEN,                     /* handed out from the warm pool, kept as a cached result */
+    PROBE_IN_USE                     /* somebody answered, do not offer until the TTL runs out */
+};
+
+struct arp_packet {
+    u_int16_t htype;
+    u_int16_t ptype;
+    u_int8_t hlen;
+    u_int8_t plen;
+    u_int16_t oper;
+    unsigned char sha[ETH_ALEN];
+    unsigned char spa[4];
+    unsigned char tha[ETH_ALEN];
+    unsigned char tpa[4];
+} __attribute__((packed));
+
+struct probe {
+    struct in_addr addr;
+    enum probe_state state;
+    long stamp;                      /* when the probe was sent, or when the result expires */
+};
+
+static struct probe probes[MAX_PROBES];
+static int sock = -1;
+static int interface_index;
+static unsigned char interface_mac[ETH_ALEN];
+
+int arp_probe_open(const char *interface_name) {
+    sock = socket(AF_PACKET, SOCK_DGRAM | SOCK_NONBLOCK, htons(ETH_P_ARP));
+    if (sock < 0) {
+        perror("Could not create ARP socket");
+        return ERROR;
+    }
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface_name, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFINDEX, &request) < 0) {
+        printf("Could not find interface %s for ARP probing\n", interface_name);
+        close(sock);
+        return sock = ERROR;
+    }
+    interface_index = request.ifr_ifindex;
+    if (ioctl(sock, SIOCGIFHWADDR, &request) < 0) {
+        printf("Could not read the hardware address of %s\n", interface_name);
+        close(sock);
+        return sock = ERROR;
+    }
+    memcpy(interface_mac, request.ifr_hwaddr.sa_data, ETH_ALEN);
+
+    struct sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ARP);
+    address.sll_ifindex = interface_index;
+    if (bind(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        printf("Could not bind ARP socket to %s\n", interface_name);
+        close(sock);
+        return sock = ERROR;
+    }
+
+    printf("ARP probe socket created\n");
+    return sock;
+}
+
+static struct probe *find_probe(struct in_addr addr) {
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state != PROBE_UNUSED && probes[i].addr.s_addr == addr.s_addr) return &probes[i];
+    }
+    return NULL;
+}
+
+/* A free slot, or the cached result that expires first. Warm and pending entries are never evicted. */
+static struct probe *claim_probe(void) {
+    struct probe *victim = NULL;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state == PROBE_UNUSED) return &probes[i];
+        if (probes[i].state == PROBE_TAKEN || probes[i].state == PROBE_IN_USE) {
+            if (victim == NULL || probes[i].stamp < victim->stamp) victim = &probes[i];
+        }
+    }
+    return victim;
+}
+
+static int send_probe(struct in_addr addr) {
+    struct arp_packet packet;
+    packet.htype = htons(ARPHRD_ETHER);
+    packet.ptype = htons(ETH_P_IP);
+    packet.hlen = ETH_ALEN;
+    packet.plen = 4;
+    packet.oper = htons(ARPOP_REQUEST);
+    memcpy(packet.sha, interface_mac, ETH_ALEN);
+    memset(packet.spa, 0, sizeof(packet.spa));      /* RFC 5227 probe, sender address 0.0.0.0 */
+    memset(packet.tha, 0, sizeof(packet.tha));
+    memcpy(packet.tpa, &addr.s_addr, 4);
+
+    struct sockaddr_ll destination;
+    memset(&destination, 0, sizeof(destination));
+    destination.sll_family = AF_PACKET;
+    destination.sll_protocol = htons(ETH_P_ARP);
+    destination.sll_ifindex = interface_index;
+    destination.sll_halen = ETH_ALEN;
+    memset(destination.sll_addr, 0xFF, ETH_ALEN);
+
+    int result = (int) sendto(sock, &packet, sizeof(packet), 0, (struct sockaddr *) &destination,
+                              sizeof(destination));
+    return result < 0 ? ERROR : OK;
+}
+
+int arp_probe_start(struct in_addr addr, long now, long ttl) {
+    struct probe *probe = find_probe(addr);
+    if (probe) {
+        if (probe->state == PROBE_PENDING || probe->state == PROBE_FREE) return OK;
+        if (probe->state == PROBE_IN_USE && probe->stamp > now) return ERROR;
+        if (probe->state == PROBE_TAKEN && probe->stamp > now) {
+            probe->state = PROBE_FREE;
+            probe->stamp = now + ttl;
+            return OK;
+        }
+    }
+    else {
+        probe = claim_probe();
+        if (probe == NULL) return ERROR;
+    }
+
+    probe->addr = addr;
+    probe->state = PROBE_PENDING;
+    probe->stamp = now;
+    if (send_probe(addr) == ERROR) {
+        printf("Could not send ARP probe for %s\n", inet_ntoa(addr));
+        probe->state = PROBE_UNUSED;
+        return ERROR;
+    }
+    return OK;
+}
+
+void arp_probe_receive(long now, long ttl) {
+    struct arp_packet packet;
+    while (1) {
+        ssize_t received = recv(sock, &packet, sizeof(packet), 0);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        if (received < (ssize_t) sizeof(packet) || packet.ptype != htons(ETH_P_IP)) continue;
+        if (memcmp(packet.sha, interface_mac, ETH_ALEN) == 0) continue;
+
+        /*
+         * a reply from the address or another host announcing it, or (RFC 5227 2.1.1)
+         * another host probing for it, which has sender address 0 and the address as target
+         */
+        struct in_addr claimed;
+        memcpy(&claimed.s_addr, packet.spa, 4);
+        if (claimed.s_addr == 0 && packet.oper == htons(ARPOP_REQUEST)) memcpy(&claimed.s_addr, packet.tpa, 4);
+        struct probe *probe = find_probe(claimed);
+        if (probe == NULL || probe->state == PROBE_IN_USE) continue;
+
+        printf("Address conflict: %s is already in use\n", inet_ntoa(claimed));
+        fflush(stdout);
+        probe->state = PROBE_IN_USE;
+        probe->stamp = now + ttl;
+    }
+}
+
+int arp_probe_expire(long now, long timeout, long ttl) {
+    int freed = 0;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state == PROBE_PENDING && now - probes[i].stamp >= timeout) {
+            probes[i].state = PROBE_FREE;
+            probes[i].stamp = now + ttl;
+            freed++;
+        }
+    }
+    return freed;
+}
+
+int arp_probe_take(struct in_addr *addr, long now) {
+    struct probe *best = NULL;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state != PROBE_FREE) continue;
+        if (probes[i].stamp <= now) {
+            /* the cached result is stale, probe the address again before it is offered */
+            probes[i].state = send_probe(probes[i].addr) == OK ? PROBE_PENDING : PROBE_UNUSED;
+            probes[i].stamp = now;
+            continue;
+        }
+        if (best == NULL || ntohl(probes[i].addr.s_addr) < ntohl(best->addr.s_addr)) best = &probes[i];
+    }
+    if (best == NULL) return ERROR;
+
+    *addr = best->addr;
+    best->state = PROBE_TAKEN;
+    return OK;
+}
+
+int arp_probe_outstanding(void) {
+    int count = 0;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state == PROBE_PENDING || probes[i].state == PROBE_FREE) count++;
+    }
+    return count;
+}
+
+long arp_probe_next_timeout(long now, long timeout) {
+    long next = -1;
+    for (int i = 0; i < MAX_PROBES; i++) {
+        if (probes[i].state != PROBE_PENDING) continue;
+        long left = probes[i].stamp + timeout - now;
+        if (left < 0) left = 0;
+        if (next < 0 || left < next) next = left;
+    }
+    return next;
+}
@@ -0,0 +1,40 @@
+#ifndef DHCP_SERVER_ARP_PROBE_H
+#define DHCP_SERVER_ARP_PROBE_H
+
+#include <netinet/in.h>
+
+#define MAX_PROBES 64                /* outstanding probes plus cached results */
+
+/*
+ * Non-blocking ARP conflict detection. Candidate addresses are probed ahead of
+ * time and the ones nobody answers for are kept in a warm pool, so an offer can
+ * normally take an address that is already known to be free. Results are
+ * cached for a TTL so an address is not probed again right away.
+ */
+
+/* Open the AF_PACKET socket on interface_name, returns the fd to watch for replies. */
+int arp_probe_open(const char *interface_name);
+
+/*
+ * Probe addr unless a cached result is still fresh. Returns OK if a probe was
+ * sent or the address is already known to be free, ERROR if it is known to be
+ * in use or there is no room for another probe.
+ */
+int arp_probe_start(struct in_addr addr, long now, long ttl);
+
+/* Read all pending ARP packets and mark the probed addresses that answered or another host probes for. */
+void arp_probe_receive(long now, long ttl);
+
+/* Move probes older than timeout milliseconds to the warm pool. Returns how many became free. */
+int arp_probe_expire(long now, long timeout, long ttl);
+
+/* Pop a fresh known-free address. ERROR if the warm pool is empty. */
+int arp_probe_take(struct in_addr *addr, long now);
+
+/* Probes in flight plus warm addresses, used to decide how many new candidates to probe. */
+int arp_probe_outstanding(void);
+
+/* Milliseconds until the oldest pending probe times out, -1 if none is pending. */
+long arp_probe_next_timeout(long now, long timeout);
+
+#endif
@@ -0,0 +1,170 @@
+#include "bpf_asm.h"
+
+#include <errno.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_CPUS 1024
+
+static long bpf(int command, union bpf_attr *attr) {
+    return syscall(SYS_bpf, command, attr, sizeof(*attr));
+}
+
+void bpf_asm_init(struct bpf_asm *assembler) {
+    memset(assembler, 0, sizeof(*assembler));
+}
+
+void bpf_asm_emit(struct bpf_asm *assembler, u_int8_t code, int dst, int src, int16_t off, int32_t imm) {
+    if (assembler->length == BPF_ASM_MAX_INSTRUCTIONS) return;    /* refused by bpf_asm_load_xdp() */
+    assembler->program[assembler->length++] = (struct bpf_insn) {code, dst, src, off, imm};
+}
+
+void bpf_asm_jump(struct bpf_asm *assembler, u_int8_t code, int dst, int src, int32_t imm, int label) {
+    if (assembler->length < BPF_ASM_MAX_INSTRUCTIONS) assembler->jump_labels[assembler->length] = label + 1;
+    bpf_asm_emit(assembler, code, dst, src, 0, imm);
+}
+
+void bpf_asm_place(struct bpf_asm *assembler, int label) {
+    assembler->labels[label] = assembler->length;
+}
+
+void bpf_asm_load_map(struct bpf_asm *assembler, int dst, int map_fd) {
+    bpf_asm_emit(assembler, BPF_LD | BPF_DW | BPF_IMM, dst, BPF_PSEUDO_MAP_FD, 0, map_fd);
+    bpf_asm_emit(assembler, 0, 0, 0, 0, 0);
+}
+
+void bpf_asm_count(struct bpf_asm *assembler, int key, int map_fd) {
+    bpf_asm_emit(assembler, BPF_STX | BPF_W | BPF_MEM, 10, key, -4, 0);
+    bpf_asm_load_map(assembler, 1, map_fd);
+    bpf_asm_emit(assembler, BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0);
+    bpf_asm_emit(assembler, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -4);
+    bpf_asm_emit(assembler, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    bpf_asm_emit(assembler, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 3, 0);
+    bpf_asm_emit(assembler, BPF_LDX | BPF_DW | BPF_MEM, 1, 0, 0, 0);
+    bpf_asm_emit(assembler, BPF_ALU64 | BPF_ADD | BPF_K, 1, 0, 0, 1);
+    bpf_asm_emit(assembler, BPF_STX | BPF_DW | BPF_MEM, 0, 1, 0, 0);
+}
+
+int bpf_asm_load_xdp(struct bpf_asm *assembler) {
+    if (assembler->length == BPF_ASM_MAX_INSTRUCTIONS) {
+        printf("BPF program is too long\n");
+        return ERROR;
+    }
+    for (int i = 0; i < assembler->length; i++) {
+        int label = assembler->jump_labels[i];
+        if (label) assembler->program[i].off = (int16_t) (assembler->labels[label - 1] - i - 1);
+    }
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.prog_type = BPF_PROG_TYPE_XDP;
+    attr.insns = (u_int64_t) (unsigned long) assembler->program;
+    attr.insn_cnt = assembler->length;
+    attr.license = (u_int64_t) (unsigned long) "GPL";
+    int program_fd = (int) bpf(BPF_PROG_LOAD, &attr);
+    if (program_fd < 0) {
+        /* load again for the tail of the verifier log, which says why */
+        int error = errno;
+        static char log[1 << 20];
+        attr.log_buf = (u_int64_t) (unsigned long) log;
+        attr.log_size = sizeof(log);
+        attr.log_level = 1;
+        bpf(BPF_PROG_LOAD, &attr);
+        size_t used = strlen(log);
+        printf("Could not load the XDP program: %s\n%s", strerror(error), used > 2048 ? log + used - 2048 : log);
+        return ERROR;
+    }
+    return program_fd;
+}
+
+int bpf_attach_xdp(int program_fd, const char *interface_name) {
+    unsigned int interface_index = if_nametoindex(interface_name);
+    if (interface_index == 0) {
+        printf("Could not find interface %s for XDP\n", interface_name);
+        return ERROR;
+    }
+
+    u_int32_t modes[] = {XDP_FLAGS_DRV_MODE, XDP_FLAGS_SKB_MODE};
+    const char *mode_names[] = {"native", "generic"};
+    for (int i = 0; i < 2; i++) {
+        union bpf_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.link_create.prog_fd = program_fd;
+        attr.link_create.target_ifindex = interface_index;
+        attr.link_create.attach_type = BPF_XDP;
+        attr.link_create.flags = modes[i];
+        int link_fd = (int) bpf(BPF_LINK_CREATE, &attr);
+        if (link_fd >= 0) {
+            printf("XDP program attached to %s in %s mode\n", interface_name, mode_names[i]);
+            return link_fd;
+        }
+    }
+    printf("Could not attach the XDP program to %s: %s\n", interface_name, strerror(errno));
+    return ERROR;
+}
+
+int bpf_map_create(u_int32_t type, u_int32_t key_size, u_int32_t value_size, u_int32_t max_entries) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = type;
+    attr.key_size = key_size;
+    attr.value_size = value_size;
+    attr.max_entries = max_entries;
+    int map_fd = (int) bpf(BPF_MAP_CREATE, &attr);
+    if (map_fd < 0) perror("Could not create a BPF map");
+    return map_fd < 0 ? ERROR : map_fd;
+}
+
+int bpf_map_update(int map_fd, const void *key, const void *value) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (u_int64_t) (unsigned long) key;
+    attr.value = (u_int64_t) (unsigned long) value;
+    attr.flags = BPF_ANY;
+    return bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0 ? ERROR : OK;
+}
+
+int bpf_map_delete(int map_fd, const void *key) {
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (u_int64_t) (unsigned long) key;
+    return bpf(BPF_MAP_DELETE_ELEM, &attr) < 0 ? ERROR : OK;
+}
+
+/* Per-CPU maps hold one value per possible CPU, "0-N" in sysfs. */
+static int possible_cpus(void) {
+    static int count;
+    if (count) return count;
+    FILE *file = fopen("/sys/devices/system/cpu/possible", "r");
+    int first = 0, last = 0;
+    if (file == NULL) return count = (int) sysconf(_SC_NPROCESSORS_CONF);
+    if (fscanf(file, "%d-%d", &first, &last) < 2) last = first;
+    fclose(file);
+    return count = last + 1;
+}
+
+u_int64_t bpf_map_sum(int map_fd, u_int32_t key) {
+    u_int64_t values[MAX_CPUS];
+    int cpu_count = possible_cpus();
+    if (cpu_count <= 0 || cpu_count > MAX_CPUS) return 0;
+
+    union bpf_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = map_fd;
+    attr.key = (u_int64_t) (unsigned long) &key;
+    attr.value = (u_int64_t) (unsigned long) values;
+    if (bpf(BPF_MAP_LOOKUP_ELEM, &attr) < 0) return 0;
+
+    u_int64_t total = 0;
+    for (int cpu = 0; cpu < cpu_count; cpu++) total += values[cpu];
+    return total;
+}
@@ -0,0 +1,52 @@
+#ifndef DHCP_SERVER_BPF_ASM_H
+#define DHCP_SERVER_BPF_ASM_H
+
+#include <linux/bpf.h>
+#include <sys/types.h>
+
+#define BPF_ASM_MAX_INSTRUCTIONS 256
+#define BPF_ASM_MAX_LABELS       32
+
+/*
+ * A small eBPF assembler and loader, so XDP programs can be written next to
+ * the code that uses them without a BPF compiler or libbpf. Jumps name a
+ * label that is placed later; bpf_asm_load_xdp() resolves them, loads the
+ * program through bpf(2) and prints the verifier's reason if it is rejected.
+ */
+
+struct bpf_asm {
+    struct bpf_insn program[BPF_ASM_MAX_INSTRUCTIONS];
+    int jump_labels[BPF_ASM_MAX_INSTRUCTIONS];    /* label + 1 for jumps, 0 otherwise */
+    int labels[BPF_ASM_MAX_LABELS];
+    int length;
+};
+
+void bpf_asm_init(struct bpf_asm *assembler);
+void bpf_asm_emit(struct bpf_asm *assembler, u_int8_t code, int dst, int src, int16_t off, int32_t imm);
+void bpf_asm_jump(struct bpf_asm *assembler, u_int8_t code, int dst, int src, int32_t imm, int label);
+void bpf_asm_place(struct bpf_asm *assembler, int label);
+
+/* dst = the map behind map_fd, for helper calls */
+void bpf_asm_load_map(struct bpf_asm *assembler, int dst, int map_fd);
+
+/* Add one to this CPU's value at the u32 key in register key of a per-CPU array map. Clobbers r0-r5. */
+void bpf_asm_count(struct bpf_asm *assembler, int key, int map_fd);
+
+/* Load as an XDP program. Returns the program fd, ERROR on failure. */
+int bpf_asm_load_xdp(struct bpf_asm *assembler);
+
+/*
+ * Attach in native mode, or generic mode where the driver has no XDP. Returns
+ * the link fd, ERROR on failure; the program stays attached until every copy
+ * of the link fd is closed.
+ */
+int bpf_attach_xdp(int program_fd, const char *interface_name);
+
+int bpf_map_create(u_int32_t type, u_int32_t key_size, u_int32_t value_size, u_int32_t max_entries);
+int bpf_map_update(int map_fd, const void *key, const void *value);
+int bpf_map_delete(int map_fd, const void *key);
+
+/* Sum of all CPUs' values at key in a per-CPU array of u64, 0 if it cannot be read. */
+u_int64_t bpf_map_sum(int map_fd, u_int32_t key);
+
+#endif
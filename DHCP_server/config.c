@@ -0,0 +1,382 @@
+#include "config.h"
+#include "flood.h"
+#include "lease.h"
+#include "replication.h"
+
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_KEY_LENGTH   32
+#define MAX_VALUE_LENGTH 64
+
+struct config_reader {
+    _Atomic unsigned long counter;   /* 0 while offline, otherwise the last grace period seen */
+};
+
+static _Atomic(struct server_config *) current_config;
+static _Atomic unsigned long grace_period = 1;
+
+static struct config_reader readers[MAX_CONFIG_READERS];
+static _Atomic int reader_count;
+static __thread struct config_reader *self;
+
+static const char *reload_path;
+static struct in_addr reload_server_ip;
+
+static struct in_addr host_in_subnet(struct in_addr server_ip, int host) {
+    struct in_addr addr = server_ip;
+    addr.s_addr &= 0x00FFFFFF;
+    addr.s_addr |= ((u_int32_t) host << 24);
+    return addr;
+}
+
+static int parse_address(const char *value, struct in_addr server_ip, struct in_addr *addr) {
+    char *end;
+    long host = strtol(value, &end, 10);
+    if (*end == '\0' && host > 0 && host < 255) {
+        *addr = host_in_subnet(server_ip, (int) host);
+        return OK;
+    }
+    return inet_aton(value, addr) ? OK : ERROR;
+}
+
+static int parse_number(const char *value, long min, long max, int *number) {
+    char *end;
+    long parsed = strtol(value, &end, 10);
+    if (*end != '\0' || parsed < min || parsed > max) return ERROR;
+    *number = (int) parsed;
+    return OK;
+}
+
+/* "a.b.c.d:port" */
+static int parse_endpoint(const char *value, struct sockaddr_in *endpoint) {
+    char host[MAX_VALUE_LENGTH];
+    int port;
+    const char *colon = strrchr(value, ':');
+    if (colon == NULL || colon - value >= (long) sizeof(host)) return ERROR;
+    memcpy(host, value, colon - value);
+    host[colon - value] = '\0';
+    if (parse_number(colon + 1, 1, 65535, &port) == ERROR) return ERROR;
+
+    memset(endpoint, 0, sizeof(*endpoint));
+    endpoint->sin_family = AF_INET;
+    endpoint->sin_port = htons((in_port_t) port);
+    return inet_aton(host, &endpoint->sin_addr) ? OK : ERROR;
+}
+
+static int set_option(struct server_config *config, const char *key, const char *value,
+                      struct in_addr server_ip) {
+    if (strcmp(key, "interface") == 0) {
+        if (strlen(value) >= sizeof(config->interface_name)) return ERROR;
+        strcpy(config->interface_name, value);
+        return OK;
+    }
+    if (strcmp(key, "pool_start") == 0) return parse_address(value, server_ip, &config->start_ip);
+    if (strcmp(key, "pool_end") == 0) return parse_address(value, server_ip, &config->end_ip);
+    if (strcmp(key, "router") == 0) return parse_address(value, server_ip, &config->router);
+    if (strcmp(key, "dns") == 0) return parse_address(value, server_ip, &config->dns);
+    if (strcmp(key, "reservations") == 0) {
+        reservation_free(config->reservations);
+        config->reservations = reservation_load(value);
+        return config->reservations ? OK : ERROR;
+    }
+    if (strcmp(key, "packet_ring") == 0) return parse_number(value, 0, 1, &config->packet_ring);
+    if (strcmp(key, "xdp_filter") == 0) return parse_number(value, 0, 1, &config->xdp_filter);
+    if (strcmp(key, "arp_probe") == 0) return parse_number(value, 0, 1, &config->arp_probe);
+    if (strcmp(key, "arp_probe_timeout") == 0) {
+        int timeout;
+        if (parse_number(value, 1, 10000, &timeout) == ERROR) return ERROR;
+        config->arp_probe_timeout = timeout;
+        return OK;
+    }
+    if (strcmp(key, "arp_probe_ttl") == 0) {
+        int ttl;
+        if (parse_number(value, 1, 86400, &ttl) == ERROR) return ERROR;
+        config->arp_probe_ttl = ttl * 1000L;
+        return OK;
+    }
+    if (strcmp(key, "arp_probe_pool") == 0) {
+        return parse_number(value, 1, MAX_ARP_PROBE_POOL, &config->arp_probe_pool);
+    }
+    if (strcmp(key, "replication_port") == 0) {
+        int port;
+        if (parse_number(value, 1, 65535, &port) == ERROR) return ERROR;
+        config->replication_port = (in_port_t) port;
+        return OK;
+    }
+    if (strcmp(key, "replication_peer") == 0) return parse_endpoint(value, &config->replication_peer);
+    if (strcmp(key, "replication_role") == 0) {
+        if (strcmp(value, "active") != 0 && strcmp(value, "standby") != 0) return ERROR;
+        config->replication_active = strcmp(value, "active") == 0;
+        return OK;
+    }
+    if (strcmp(key, "failover_timeout") == 0) {
+        int timeout;
+        if (parse_number(value, 10, 600000, &timeout) == ERROR) return ERROR;
+        config->failover_timeout = timeout;
+        return OK;
+    }
+    if (strcmp(key, "circuit_quota") == 0) return parse_number(value, 0, MAX_LEASE_LIMIT, &config->circuit_quota);
+    if (strcmp(key, "flood_threshold") == 0) return parse_number(value, 0, 1000000, &config->flood_threshold);
+    if (strcmp(key, "query_socket") == 0) {
+        if (strlen(value) >= sizeof(config->query_socket)) return ERROR;
+        strcpy(config->query_socket, value);
+        return OK;
+    }
+    if (strcmp(key, "handoff_socket") == 0) {
+        if (strlen(value) >= sizeof(config->handoff_socket)) return ERROR;
+        strcpy(config->handoff_socket, value);
+        return OK;
+    }
+    if (strcmp(key, "max_leases") == 0) return parse_number(value, 1, MAX_LEASE_LIMIT, &config->max_leases);
+    if (strcmp(key, "pin_cpu") == 0) {
+        return parse_number(value, -1, sysconf(_SC_NPROCESSORS_CONF) - 1, &config->pin_cpu);
+    }
+    if (strcmp(key, "busy_poll") == 0) return parse_number(value, 0, MAX_SPIN_TIME, &config->busy_poll);
+    if (strcmp(key, "spin_time") == 0) return parse_number(value, 0, MAX_SPIN_TIME, &config->spin_time);
+    if (strcmp(key, "lease_time") == 0) {
+        char *end;
+        unsigned long seconds = strtoul(value, &end, 10);
+        if (*end != '\0' || seconds == 0 || seconds > 0xFFFFFFFFUL) return ERROR;
+        config->lease_time = (u_int32_t) seconds;
+        return OK;
+    }
+    return ERROR;
+}
+
+static int compare_address(const void *a, const void *b) {
+    u_int32_t x = *(const u_int32_t *) a, y = *(const u_int32_t *) b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Mark the pool addresses that belong to static hosts so the dynamic allocator
+ * skips them. An address reserved twice would be handed to both hosts, a bit
+ * already set catches that inside the pool, the rest are sorted and compared.
+ */
+static int build_reserved_pool(struct server_config *config, const char *path) {
+    if (config->reservations == NULL) return OK;
+
+    u_int32_t start = ntohl(config->start_ip.s_addr), end = ntohl(config->end_ip.s_addr);
+    u_int32_t count = config->reservations->count;
+    config->reserved_pool = calloc((end - start) / 8 + 1, 1);
+    u_int32_t *outside = malloc((count ? count : 1) * sizeof(*outside));
+    if (config->reserved_pool == NULL || outside == NULL) {
+        free(outside);
+        return ERROR;
+    }
+
+    u_int32_t outside_count = 0, duplicate = 0;
+    int found = 0;
+    for (u_int32_t i = 0; i < count && !found; i++) {
+        u_int32_t addr = ntohl(config->reservations->entries[i].address.s_addr);
+        if (addr < start || addr > end) {
+            outside[outside_count++] = addr;
+            continue;
+        }
+        unsigned char bit = (unsigned char) (1 << ((addr - start) % 8));
+        found = config->reserved_pool[(addr - start) / 8] & bit;
+        if (found) duplicate = addr;
+        config->reserved_pool[(addr - start) / 8] |= bit;
+    }
+    if (!found) {
+        qsort(outside, outside_count, sizeof(*outside), compare_address);
+        for (u_int32_t i = 1; i < outside_count && !found; i++) {
+            found = outside[i - 1] == outside[i];
+            if (found) duplicate = outside[i];
+        }
+    }
+    free(outside);
+
+    if (found) {
+        struct in_addr address = {.s_addr = htonl(duplicate)};
+        printf("%s: %s is reserved for more than one hardware address\n", path, inet_ntoa(address));
+        return ERROR;
+    }
+    return OK;
+}
+
+struct server_config *config_load(const char *path, struct in_addr server_ip) {
+    struct server_config *config = calloc(1, sizeof(*config));
+    if (config == NULL) return NULL;
+
+    strcpy(config->interface_name, DEFAULT_INTERFACE);
+    config->start_ip = host_in_subnet(server_ip, DEFAULT_START_IP);
+    config->end_ip = host_in_subnet(server_ip, DEFAULT_END_IP);
+    config->lease_time = DEFAULT_LEASE_TIME;
+    config->router = server_ip;
+    config->dns = server_ip;
+    config->arp_probe_timeout = DEFAULT_ARP_PROBE_TIMEOUT;
+    config->arp_probe_ttl = DEFAULT_ARP_PROBE_TTL * 1000L;
+    config->arp_probe_pool = DEFAULT_ARP_PROBE_POOL;
+    config->replication_active = 1;
+    config->failover_timeout = DEFAULT_FAILOVER_TIMEOUT;
+    config->flood_threshold = DEFAULT_FLOOD_THRESHOLD;
+    config->pin_cpu = -1;
+    config->max_leases = DEFAULT_MAX_LEASES;
+
+    if (path == NULL) return config;
+
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Could not open config file %s, using defaults\n", path);
+        return config;
+    }
+
+    char *line = NULL;
+    size_t len = 0;
+    int line_number = 0;
+    while (getline(&line, &len, file) != -1) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char key[MAX_KEY_LENGTH], value[MAX_VALUE_LENGTH];
+        int fields = sscanf(line, "%31s %63s", key, value);
+        if (fields <= 0) continue;
+        if (fields != 2 || set_option(config, key, value, server_ip) == ERROR) {
+            printf("%s:%d: invalid config line\n", path, line_number);
+            free(line);
+            fclose(file);
+            config_free(config);
+            return NULL;
+        }
+    }
+    free(line);
+    fclose(file);
+
+    if (ntohl(config->start_ip.s_addr) > ntohl(config->end_ip.s_addr)) {
+        printf("%s: pool_start is after pool_end\n", path);
+        config_free(config);
+        return NULL;
+    }
+    if (config->replication_port && config->replication_peer.sin_port == 0) {
+        printf("%s: replication_port needs a replication_peer\n", path);
+        config_free(config);
+        return NULL;
+    }
+    if (build_reserved_pool(config, path) == ERROR) {
+        config_free(config);
+        return NULL;
+    }
+    return config;
+}
+
+void config_free(struct server_config *config) {
+    if (config == NULL) return;
+    reservation_free(config->reservations);
+    free(config->reserved_pool);
+    free(config);
+}
+
+void config_print(const struct server_config *config) {
+    printf("Pool: %s", inet_ntoa(config->start_ip));
+    printf(" - %s, lease time %u seconds\n", inet_ntoa(config->end_ip), config->lease_time);
+    printf("Router: %s", inet_ntoa(config->router));
+    printf(", DNS: %s\n", inet_ntoa(config->dns));
+    if (config->reservations) printf("Static reservations: %u\n", config->reservations->count);
+    if (config->pin_cpu >= 0 || config->busy_poll || config->spin_time) {
+        printf("Low latency: cpu %d, busy poll %d us, spin %d us\n", config->pin_cpu, config->busy_poll,
+               config->spin_time);
+    }
+    if (config->arp_probe) {
+        printf("ARP probing: %ld ms timeout, %ld s cache, %d warm addresses\n", config->arp_probe_timeout,
+               config->arp_probe_ttl / 1000, config->arp_probe_pool);
+    }
+}
+
+void config_publish(struct server_config *config) {
+    atomic_store(&current_config, config);
+}
+
+void config_register_reader(void) {
+    int index = atomic_fetch_add(&reader_count, 1);
+    if (index >= MAX_CONFIG_READERS) {
+        printf("Too many config readers\n");
+        exit(EXIT_FAILURE);
+    }
+    self = &readers[index];
+    config_online();
+}
+
+const struct server_config *config_get(void) {
+    return atomic_load_explicit(&current_config, memory_order_acquire);
+}
+
+void config_quiescent(void) {
+    atomic_store(&self->counter, atomic_load(&grace_period));
+}
+
+void config_offline(void) {
+    atomic_store(&self->counter, 0);
+}
+
+void config_online(void) {
+    atomic_store(&self->counter, atomic_load(&grace_period));
+}
+
+/* Wait until every reader has passed through a quiescent state or is offline. */
+static void synchronize_readers(void) {
+    unsigned long target = atomic_fetch_add(&grace_period, 1) + 1;
+    int count = atomic_load(&reader_count);
+    for (int i = 0; i < count; i++) {
+        while (1) {
+            unsigned long seen = atomic_load(&readers[i].counter);
+            if (seen == 0 || seen >= target) break;
+            struct timespec pause = {0, 1000000};
+            nanosleep(&pause, NULL);
+        }
+    }
+}
+
+static void *reload_thread(void *arg) {
+    sigset_t *signals = arg;
+    while (1) {
+        int signal_number;
+        if (sigwait(signals, &signal_number) != 0) continue;
+
+        printf("Reloading configuration from %s\n", reload_path);
+        struct server_config *config = config_load(reload_path, reload_server_ip);
+        if (config == NULL) {
+            printf("Keeping the old configuration\n");
+            fflush(stdout);
+            continue;
+        }
+
+        struct server_config *old = atomic_exchange(&current_config, config);
+        if (strcmp(old->interface_name, config->interface_name) != 0) {
+            printf("Interface change needs a restart, still serving %s\n", old->interface_name);
+        }
+        config_print(config);
+        fflush(stdout);
+
+        synchronize_readers();
+        config_free(old);
+    }
+    return NULL;
+}
+
+int config_start_reload_thread(const char *path, struct in_addr server_ip) {
+    static sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGHUP);
+    if (pthread_sigmask(SIG_BLOCK, &signals, NULL) != 0) return ERROR;
+
+    reload_path = path;
+    reload_server_ip = server_ip;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, reload_thread, &signals) != 0) return ERROR;
+    pthread_detach(thread);
+    return OK;
+}
@@ -0,0 +1,93 @@
+#ifndef DHCP_SERVER_CONFIG_H
+#define DHCP_SERVER_CONFIG_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <sys/un.h>
+#include <sys/types.h>
+
+#include "reservation.h"
+
+#define DEFAULT_INTERFACE  "enp0s3"
+#define DEFAULT_START_IP   120      /* last octet of the first pool address in the server's /24 */
+#define DEFAULT_END_IP     150      /* last octet of the last pool address in the server's /24 */
+#define DEFAULT_LEASE_TIME 120      /* seconds */
+
+#define DEFAULT_ARP_PROBE_TIMEOUT 200   /* milliseconds without a reply before an address counts as free */
+#define DEFAULT_ARP_PROBE_TTL     60    /* seconds a probe result is trusted */
+#define DEFAULT_ARP_PROBE_POOL    8     /* known-free addresses kept ready for offers */
+#define MAX_ARP_PROBE_POOL        32
+
+#define MAX_CONFIG_READERS 16
+
+#define MAX_SPIN_TIME 1000000   /* microseconds */
+
+/*
+ * Everything the packet path needs to answer a client. A config object is
+ * never modified after it has been published; a reload builds a new one and
+ * swaps the pointer, so readers never take a lock.
+ */
+struct server_config {
+    char interface_name[IFNAMSIZ];   /* only read at startup, sockets are not re-bound on reload */
+    struct in_addr start_ip;         /* first address of the dynamic pool */
+    struct in_addr end_ip;           /* last address of the dynamic pool */
+    u_int32_t lease_time;            /* seconds */
+    struct in_addr router;           /* option 3 */
+    struct in_addr dns;              /* option 6 */
+    struct reservation_table *reservations;  /* static hosts, NULL if none are configured */
+    unsigned char *reserved_pool;    /* bit per pool address, set if it is reserved for a static host */
+    int packet_ring;                 /* receive through a TPACKET_V3 ring instead of the UDP socket, startup only */
+    int xdp_filter;                  /* drop malformed requests in XDP, startup only */
+    int arp_probe;                   /* probe addresses before offering them, socket is opened at startup */
+    long arp_probe_timeout;          /* milliseconds */
+    long arp_probe_ttl;              /* milliseconds */
+    int arp_probe_pool;
+    in_port_t replication_port;      /* 0 if replication is off, read at startup only */
+    struct sockaddr_in replication_peer;
+    int replication_active;          /* start as the active instance instead of the standby */
+    long failover_timeout;           /* milliseconds */
+    int max_leases;                  /* size of the lease table, startup only */
+    int circuit_quota;               /* active leases per option 82 circuit, 0 if unlimited */
+    int flood_threshold;             /* new hardware addresses per second that raise a flood alert, 0 if off */
+    char query_socket[sizeof(((struct sockaddr_un *) 0)->sun_path)];   /* Unix socket path for lease queries, empty if off */
+    char handoff_socket[sizeof(((struct sockaddr_un *) 0)->sun_path)]; /* Unix socket path for upgrades, startup only */
+    int pin_cpu;                     /* core the packet thread runs on, -1 to leave it to the scheduler, startup only */
+    int busy_poll;                   /* SO_BUSY_POLL microseconds on the receive socket, 0 if off, startup only */
+    int spin_time;                   /* microseconds to poll for the next request before sleeping, 0 to sleep at once */
+};
+
+/* Parse path into a new config object, filling unset keys from server_ip. NULL on error. */
+struct server_config *config_load(const char *path, struct in_addr server_ip);
+void config_free(struct server_config *config);
+void config_print(const struct server_config *config);
+
+/* Whether addr (host byte order) is inside the pool and held back for a static host. */
+static inline int config_is_reserved(const struct server_config *config, u_int32_t addr) {
+    if (config->reserved_pool == NULL) return 0;
+    u_int32_t offset = addr - ntohl(config->start_ip.s_addr);
+    if (addr < ntohl(config->start_ip.s_addr) || addr > ntohl(config->end_ip.s_addr)) return 0;
+    return (config->reserved_pool[offset / 8] >> (offset % 8)) & 1;
+}
+
+/* Publish the first config, must be called before any reader is started. */
+void config_publish(struct server_config *config);
+
+/*
+ * Reader side (quiescent-state based RCU). Every thread that calls
+ * config_get() registers once; the pointer it returns stays valid until the
+ * thread calls config_quiescent() or config_offline(). A thread about to block
+ * for an unbounded time goes offline so that it never holds up a reload.
+ */
+void config_register_reader(void);
+const struct server_config *config_get(void);
+void config_quiescent(void);
+void config_offline(void);
+void config_online(void);
+
+/*
+ * Start the thread that reloads path on SIGHUP. SIGHUP is blocked in the
+ * calling thread, so call this before creating any other thread.
+ */
+int config_start_reload_thread(const char *path, struct in_addr server_ip);
+
+#endif
@@ -0,0 +1,161 @@
+#include "flood.h"
+#include "reservation.h"
+
+#include <arpa/inet.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#define HLL_REGISTERS (1 << FLOOD_HLL_BITS)
+#define FLOOD_OVERFLOW FLOOD_INGRESS   /* shared by ingresses that find every other slot busy */
+
+struct ingress_window {
+    struct in_addr ingress;          /* the ingress the slot belongs to, any for the overflow slot */
+    long start;                      /* milliseconds, 0 before the first packet */
+    unsigned long discovers;
+    unsigned long requests;
+    unsigned long new_addresses;
+    int alerted;                     /* already reported in this window */
+    unsigned char registers[HLL_REGISTERS];
+};
+
+/* two generations, each covers one window: a flood fills at most what it sends in two windows */
+static u_int16_t sketch[2][FLOOD_SKETCH_DEPTH][FLOOD_SKETCH_WIDTH];
+static int generation;               /* the one counted into */
+static long generation_start;
+static struct ingress_window windows[FLOOD_INGRESS + 1];
+
+/* what flood_format() reports, written by the receiving thread */
+static _Atomic long alert_until[FLOOD_INGRESS + 1];
+static _Atomic unsigned long alerts;
+static _Atomic unsigned long last_new, last_distinct, last_completed_pct;
+static _Atomic long last_detect_ms;
+
+static long monotonic_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
+/*
+ * The slot of ingress: probe from its hash for the slot that holds it, else
+ * take the first whose window has ended, else share the overflow slot. Two
+ * relays never count into the same window unless more than FLOOD_INGRESS are
+ * busy in the same second.
+ */
+static struct ingress_window *window_for(struct in_addr ingress, long now) {
+    u_int32_t first = (u_int32_t) (reservation_hash(ingress.s_addr, FLOOD_INGRESS) % FLOOD_INGRESS);
+    struct ingress_window *window = NULL, *idle = NULL;
+    for (u_int32_t i = 0; i < FLOOD_INGRESS && window == NULL; i++) {
+        struct ingress_window *candidate = &windows[(first + i) % FLOOD_INGRESS];
+        int ended = now - candidate->start >= FLOOD_WINDOW;
+        if (candidate->start && candidate->ingress.s_addr == ingress.s_addr) window = candidate;
+        else if (ended && idle == NULL) idle = candidate;
+    }
+    if (window == NULL) window = idle ? idle : &windows[FLOOD_OVERFLOW];
+
+    if (now - window->start >= FLOOD_WINDOW) {
+        memset(window, 0, sizeof(*window));
+        window->start = now;
+    }
+    if (window != &windows[FLOOD_OVERFLOW]) window->ingress = ingress;
+    return window;
+}
+
+static unsigned long hll_estimate(const unsigned char *registers) {
+    double sum = 0;
+    int zeros = 0;
+    for (int i = 0; i < HLL_REGISTERS; i++) {
+        sum += ldexp(1.0, -registers[i]);
+        if (registers[i] == 0) zeros++;
+    }
+    double m = HLL_REGISTERS, estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+    if (estimate <= 2.5 * m && zeros) estimate = m * log(m / zeros);
+    return (unsigned long) (estimate + 0.5);
+}
+
+/*
+ * Start a new generation every window and drop the one before the last, so
+ * addresses that stopped appearing become new again and a long flood cannot
+ * fill the sketch until every address reads as seen.
+ */
+static void age_sketch(long now) {
+    if (now - generation_start < FLOOD_WINDOW) return;
+    if (now - generation_start >= 2 * FLOOD_WINDOW) memset(sketch[generation], 0, sizeof(sketch[generation]));
+    generation ^= 1;
+    memset(sketch[generation], 0, sizeof(sketch[generation]));
+    generation_start = now;
+}
+
+/* Count chaddr in the sketch, returns whether neither generation has seen it. */
+static int sketch_add(u_int64_t hash) {
+    u_int16_t minimum = UINT16_MAX, before = UINT16_MAX;
+    for (int row = 0; row < FLOOD_SKETCH_DEPTH; row++) {
+        u_int32_t column = (u_int32_t) ((hash >> (row * 16)) % FLOOD_SKETCH_WIDTH);
+        u_int16_t *counter = &sketch[generation][row][column];
+        if (*counter < minimum) minimum = *counter;
+        if (*counter < UINT16_MAX) (*counter)++;
+        if (sketch[generation ^ 1][row][column] < before) before = sketch[generation ^ 1][row][column];
+    }
+    return minimum == 0 && before == 0;
+}
+
+static void raise_alert(struct ingress_window *window, long now) {
+    int slot = (int) (window - windows);
+    unsigned long distinct = hll_estimate(window->registers);
+    unsigned long completed = window->requests * 100 / window->discovers;
+
+    window->alerted = 1;
+    /* long enough to be raised again in the next window while the flood goes on */
+    atomic_store(&alert_until[slot], now + 2 * FLOOD_WINDOW);
+    atomic_fetch_add(&alerts, 1);
+    atomic_store(&last_new, window->new_addresses);
+    atomic_store(&last_distinct, distinct);
+    atomic_store(&last_completed_pct, completed);
+    atomic_store(&last_detect_ms, now - window->start);
+
+    const char *source = slot == FLOOD_OVERFLOW ? "overflowing relays"
+                         : window->ingress.s_addr ? inet_ntoa(window->ingress) : "local segment";
+    printf("DISCOVER flood on %s: %lu new hardware addresses in %ld ms, %lu%% completed\n", source,
+           window->new_addresses, now - window->start, completed);
+}
+
+void flood_note_discover(struct in_addr ingress, const unsigned char *chaddr, long now, int threshold) {
+    age_sketch(now);
+    struct ingress_window *window = window_for(ingress, now);
+    u_int64_t hash = reservation_hash(reservation_key(chaddr), 0);
+
+    window->discovers++;
+    if (sketch_add(hash)) window->new_addresses++;
+
+    /* the low bits pick the register, the rank of the rest is what it remembers */
+    unsigned char *registers = &window->registers[hash & (HLL_REGISTERS - 1)];
+    u_int64_t rest = hash >> FLOOD_HLL_BITS;
+    unsigned char rank = rest ? (unsigned char) (__builtin_ctzll(rest) + 1) : 64 - FLOOD_HLL_BITS + 1;
+    if (rank > *registers) *registers = rank;
+
+    /* starvation that completes every exchange still shows as new addresses, one that does not sooner */
+    unsigned long limit = window->requests * 2 < window->discovers ? (threshold + 1) / 2 : threshold;
+    if (threshold && !window->alerted && window->new_addresses >= limit) raise_alert(window, now);
+}
+
+void flood_note_request(struct in_addr ingress, long now) {
+    window_for(ingress, now)->requests++;
+}
+
+int flood_format(char *buffer, size_t size) {
+    long now = monotonic_ms();
+    int active = 0;
+    for (int i = 0; i <= FLOOD_OVERFLOW; i++) {
+        if (atomic_load(&alert_until[i]) > now) active++;
+    }
+    int length = snprintf(buffer, size,
+                          " flood_active=%d flood_alerts=%lu flood_new=%lu flood_distinct=%lu"
+                          " flood_completed_pct=%lu flood_detect_ms=%ld",
+                          active, atomic_load(&alerts), atomic_load(&last_new), atomic_load(&last_distinct),
+                          atomic_load(&last_completed_pct), atomic_load(&last_detect_ms));
+    return length >= (int) size ? (int) size - 1 : length;
+}
@@ -0,0 +1,36 @@
+#ifndef DHCP_SERVER_FLOOD_H
+#define DHCP_SERVER_FLOOD_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+#define DEFAULT_FLOOD_THRESHOLD 20   /* new hardware addresses per second on one ingress */
+
+#define FLOOD_WINDOW       1000      /* milliseconds */
+#define FLOOD_INGRESS      16        /* ingress slots busy at once, relays beyond that share one more */
+#define FLOOD_SKETCH_DEPTH 4
+#define FLOOD_SKETCH_WIDTH 2048
+#define FLOOD_HLL_BITS     8         /* 256 registers, about 6.5% error */
+
+/*
+ * DISCOVER-flood detector in constant memory. A count-min sketch remembers
+ * which hardware addresses have been seen in this window and the one before;
+ * one that estimates zero in both is certainly new. Clearing a generation per
+ * window keeps the sketch from filling up during the very flood it measures.
+ * Per ingress (giaddr, or the local segment) and per one second window it
+ * counts new addresses, DISCOVERs and REQUESTs and keeps a HyperLogLog of the
+ * distinct addresses. An ingress that sees threshold new addresses in a window
+ * is reported at once, not at the end of the window; if fewer than half of its
+ * DISCOVERs are followed by a REQUEST, half as many are enough.
+ *
+ * Only the receiving thread updates the detector; flood_format() may be called
+ * from any thread.
+ */
+
+void flood_note_discover(struct in_addr ingress, const unsigned char *chaddr, long now, int threshold);
+void flood_note_request(struct in_addr ingress, long now);
+
+/* Append " flood_active=.. flood_alerts=.. ..." and return the length. */
+int flood_format(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,236 @@
+#define _GNU_SOURCE
+#include "handoff.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "lease.h"
+#include "quota.h"
+
+#define OK 0
+#define ERROR -1
+
+#define HANDOFF_BATCH 256            /* lease records per write */
+
+#define HANDOFF_TAKE 'T'             /* new process: stop serving and send the leases */
+#define HANDOFF_DONE 'D'             /* new process: everything arrived, exit */
+
+struct handoff_header {
+    u_int32_t lease_count;
+    struct timespec last_served;
+};
+
+struct handoff_lease {
+    unsigned char chaddr[LEASE_HLEN];
+    u_int16_t circuit;
+    struct in_addr addr;
+    u_int32_t expiry;
+};
+
+static int listener = -1;
+static int connection = -1;          /* to the other process between the two steps */
+static u_int64_t circuit_keys[QUOTA_CIRCUITS + 1];
+
+static void set_timeouts(int sock) {
+    struct timeval timeout = {HANDOFF_TIMEOUT / 1000, (HANDOFF_TIMEOUT % 1000) * 1000};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+}
+
+static int send_all(int sock, const void *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(sock, buffer, length, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) continue;
+        if (sent <= 0) return ERROR;
+        buffer = (const char *) buffer + sent;
+        length -= sent;
+    }
+    return OK;
+}
+
+static int receive_all(int sock, void *buffer, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(sock, buffer, length, MSG_WAITALL);
+        if (received < 0 && errno == EINTR) continue;
+        if (received <= 0) return ERROR;
+        buffer = (char *) buffer + received;
+        length -= received;
+    }
+    return OK;
+}
+
+/* The table of which descriptors exist goes in the body, the descriptors themselves in SCM_RIGHTS. */
+static int send_fds(int sock, const int fds[HANDOFF_FD_COUNT]) {
+    int present[HANDOFF_FD_COUNT], passed[HANDOFF_FD_COUNT], count = 0;
+    for (int i = 0; i < HANDOFF_FD_COUNT; i++) {
+        present[i] = fds[i] >= 0;
+        if (present[i]) passed[count++] = fds[i];
+    }
+
+    char control[CMSG_SPACE(sizeof(passed))];
+    memset(control, 0, sizeof(control));
+    struct iovec vector = {present, sizeof(present)};
+    struct msghdr header = {.msg_iov = &vector, .msg_iovlen = 1,
+                            .msg_control = control, .msg_controllen = CMSG_SPACE(count * sizeof(int))};
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(count * sizeof(int));
+    memcpy(CMSG_DATA(cmsg), passed, count * sizeof(int));
+
+    return sendmsg(sock, &header, MSG_NOSIGNAL) == sizeof(present) ? OK : ERROR;
+}
+
+static int receive_fds(int sock, int fds[HANDOFF_FD_COUNT]) {
+    int present[HANDOFF_FD_COUNT], passed[HANDOFF_FD_COUNT];
+    char control[CMSG_SPACE(sizeof(passed))];
+    struct iovec vector = {present, sizeof(present)};
+    struct msghdr header = {.msg_iov = &vector, .msg_iovlen = 1,
+                            .msg_control = control, .msg_controllen = sizeof(control)};
+    if (recvmsg(sock, &header, MSG_WAITALL | MSG_CMSG_CLOEXEC) != sizeof(present)) return ERROR;
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) return ERROR;
+    int count = (int) ((cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+    memcpy(passed, CMSG_DATA(cmsg), count * sizeof(int));
+
+    int used = 0;
+    for (int i = 0; i < HANDOFF_FD_COUNT; i++) {
+        fds[i] = present[i] && used < count ? passed[used++] : -1;
+    }
+    return fds[HANDOFF_DHCP] >= 0 && fds[HANDOFF_MESSAGES] >= 0 ? OK : ERROR;
+}
+
+static int send_leases(int sock, const struct timespec *last_served) {
+    struct handoff_header header = {lease_count(), *last_served};
+    quota_export(circuit_keys);
+    if (send_all(sock, &header, sizeof(header)) == ERROR) return ERROR;
+    if (send_all(sock, circuit_keys, sizeof(circuit_keys)) == ERROR) return ERROR;
+
+    struct handoff_lease batch[HANDOFF_BATCH];
+    int count = 0;
+    u_int32_t index = 0;
+    struct lease *lease;
+    while ((lease = lease_next(&index)) != NULL) {
+        memcpy(batch[count].chaddr, lease->chaddr, LEASE_HLEN);
+        batch[count].circuit = lease->circuit;
+        batch[count].addr = lease->addr;
+        batch[count].expiry = lease->expiry;
+        if (++count == HANDOFF_BATCH) {
+            if (send_all(sock, batch, sizeof(batch)) == ERROR) return ERROR;
+            count = 0;
+        }
+    }
+    return send_all(sock, batch, count * sizeof(batch[0]));
+}
+
+int handoff_listen(const char *path) {
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0) {
+        perror("Could not create handoff socket");
+        return ERROR;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return ERROR;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 1) < 0) {
+        printf("\tCould not bind handoff socket %s\n", path);
+        close(listener);
+        return listener = ERROR;
+    }
+    printf("Upgrades take over through %s\n", path);
+    return listener;
+}
+
+int handoff_accept(const int fds[HANDOFF_FD_COUNT]) {
+    connection = accept4(listener, NULL, NULL, SOCK_CLOEXEC);
+    if (connection < 0) return ERROR;
+    set_timeouts(connection);
+
+    printf("Handing the sockets over to a new server\n");
+    fflush(stdout);
+    if (send_fds(connection, fds) == ERROR) {
+        close(connection);
+        return connection = ERROR;
+    }
+    return connection;
+}
+
+int handoff_finish(const struct timespec *last_served) {
+    /* the new process only writes once it is ready, or closes the connection when it gives up */
+    char take, done;
+    if (recv(connection, &take, 1, 0) != 1 || take != HANDOFF_TAKE || send_leases(connection, last_served) == ERROR ||
+        recv(connection, &done, 1, 0) != 1 || done != HANDOFF_DONE) {
+        printf("The new server did not take over, still serving\n");
+        fflush(stdout);
+        close(connection);
+        connection = -1;
+        return ERROR;
+    }
+    close(connection);
+    connection = -1;
+    return OK;
+}
+
+int handoff_request(const char *path, int fds[HANDOFF_FD_COUNT]) {
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return ERROR;
+    strcpy(address.sun_path, path);
+
+    connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0) return ERROR;
+    if (connect(connection, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        close(connection);
+        connection = -1;
+        return HANDOFF_NONE;
+    }
+    set_timeouts(connection);
+    if (receive_fds(connection, fds) == ERROR) {
+        printf("The running server did not hand over its sockets\n");
+        close(connection);
+        return connection = ERROR;
+    }
+    return OK;
+}
+
+int handoff_take_over(struct timespec *last_served) {
+    struct handoff_header header;
+    char take = HANDOFF_TAKE, done = HANDOFF_DONE;
+    if (send_all(connection, &take, 1) == ERROR || receive_all(connection, &header, sizeof(header)) == ERROR ||
+        receive_all(connection, circuit_keys, sizeof(circuit_keys)) == ERROR) {
+        close(connection);
+        return ERROR;
+    }
+    quota_import(circuit_keys);
+
+    struct handoff_lease batch[HANDOFF_BATCH];
+    for (u_int32_t received = 0; received < header.lease_count;) {
+        u_int32_t count = header.lease_count - received < HANDOFF_BATCH ? header.lease_count - received : HANDOFF_BATCH;
+        if (receive_all(connection, batch, count * sizeof(batch[0])) == ERROR) {
+            close(connection);
+            return ERROR;
+        }
+        for (u_int32_t i = 0; i < count; i++) {
+            struct lease *lease = lease_update(batch[i].chaddr, batch[i].addr, batch[i].expiry);
+            if (lease && batch[i].circuit <= QUOTA_OVERFLOW) quota_assign(lease, batch[i].circuit);
+        }
+        received += count;
+    }
+
+    int result = send_all(connection, &done, 1);
+    close(connection);
+    connection = -1;
+    *last_served = header.last_served;
+    return result == OK ? (int) header.lease_count : ERROR;
+}
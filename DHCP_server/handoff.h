@@ -0,0 +1,57 @@
+#ifndef DHCP_SERVER_HANDOFF_H
+#define DHCP_SERVER_HANDOFF_H
+
+#include <time.h>
+
+#define HANDOFF_TIMEOUT 5000         /* milliseconds the running server waits for its successor to get ready */
+#define HANDOFF_NONE 1               /* no server is listening, start from scratch */
+
+/*
+ * Binary upgrade without closing the server's sockets. The running server
+ * listens on a Unix socket; a new process started with the same handoff path
+ * connects and takes over in two steps:
+ *
+ *   1. it receives the bound sockets (and the XDP link) with SCM_RIGHTS and
+ *      sets up everything else, while the old server keeps answering with the
+ *      connection in its select loop;
+ *   2. it asks the old server to stop, which sends its leases, the circuits
+ *      they count against and the receive time of the last request it
+ *      answered, then drains and exits.
+ *
+ * The sockets are never closed, so requests arriving in between wait in their
+ * receive queue instead of being lost.
+ */
+
+enum handoff_fd {
+    HANDOFF_DHCP = 0,                /* UDP server port */
+    HANDOFF_MESSAGES,                /* UDP port 547 */
+    HANDOFF_REPLICATION,             /* -1 when replication is off */
+    HANDOFF_XDP_LINK,                /* -1 without the XDP filter */
+    HANDOFF_XDP_COUNTERS,
+    HANDOFF_FD_COUNT
+};
+
+/* Old server: listen on path. Returns the socket to watch, ERROR on failure. */
+int handoff_listen(const char *path);
+
+/* Old server, when the listener is readable: step 1. Returns the connection to watch, ERROR if it failed. */
+int handoff_accept(const int fds[HANDOFF_FD_COUNT]);
+
+/*
+ * Old server, when the connection is readable: step 2. OK once the new
+ * process has the leases, ERROR if it gave up, in which case this server
+ * carries on and watches the listener again.
+ */
+int handoff_finish(const struct timespec *last_served);
+
+/* New process: step 1. OK with fds filled, HANDOFF_NONE if no server listens on path, ERROR if it failed. */
+int handoff_request(const char *path, int fds[HANDOFF_FD_COUNT]);
+
+/*
+ * New process: step 2, once the lease table exists. Loads the old server's
+ * leases and circuits and fills last_served. Returns the number of leases,
+ * ERROR if the old server went away.
+ */
+int handoff_take_over(struct timespec *last_served);
+
+#endif
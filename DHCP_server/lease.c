@@ -0,0 +1,346 @@
+#include "lease.h"
+
+#include <arpa/inet.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+#define EMPTY 0                      /* index entries are record number + 1 */
+#define MAX_FREED 256                /* addresses given up by reused records, waiting for the allocator */
+#define REUSE_RETRY 1                /* seconds before walking the arena again after a walk found no expired lease */
+
+_Static_assert(sizeof(struct lease) == 16, "a lease record is 16 bytes");
+
+static struct lease *records;        /* arena of max_count records, filled in order */
+static _Atomic u_int32_t *versions;  /* one per LEASE_STRIPE records */
+static _Atomic u_int32_t count;      /* read by the query thread for its stats */
+static u_int32_t max_count;
+static u_int32_t highest_address;
+static u_int32_t reuse_cursor;       /* where the next walk for an expired record starts */
+static time_t reuse_idle_until;
+static u_int32_t freed[MAX_FREED];
+static int freed_count;
+
+/* open addressing by hardware address and by address, the same size */
+static _Atomic u_int32_t *chaddr_index;
+static _Atomic u_int32_t *address_index;
+static _Atomic u_int32_t chaddr_version;     /* odd while a record changes hands */
+static _Atomic u_int32_t address_version;    /* odd while entries of the address index are shifted */
+static u_int32_t index_mask;
+
+static u_int32_t hash_chaddr(const unsigned char *chaddr) {
+    u_int64_t key = 0;
+    for (int i = 0; i < LEASE_HLEN; i++) key = (key << 8) | chaddr[i];
+    key *= 0x9E3779B97F4A7C15ULL;
+    return (u_int32_t) (key >> 32);
+}
+
+static u_int32_t hash_address(struct in_addr addr) {
+    return (u_int32_t) (((u_int64_t) addr.s_addr * 0x9E3779B97F4A7C15ULL) >> 32);
+}
+
+/* Anonymous memory that only takes up RAM once it is written. */
+static void *reserve(size_t size) {
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    return memory == MAP_FAILED ? NULL : memory;
+}
+
+int lease_table_init(u_int32_t max_leases) {
+    if (max_leases == 0 || max_leases > MAX_LEASE_LIMIT) return ERROR;
+    max_count = max_leases;
+
+    /* at least half as many slots again as leases keeps probe runs short when the table is full */
+    u_int32_t index_size = 1;
+    while (index_size < max_leases + max_leases / 2) index_size <<= 1;
+    index_mask = index_size - 1;
+
+    records = reserve((size_t) max_leases * sizeof(*records));
+    versions = reserve(((size_t) max_leases / LEASE_STRIPE + 1) * sizeof(*versions));
+    chaddr_index = reserve((size_t) index_size * sizeof(*chaddr_index));
+    address_index = reserve((size_t) index_size * sizeof(*address_index));
+    return records && versions && chaddr_index && address_index ? OK : ERROR;
+}
+
+/* Record number + 1 of chaddr's lease, or EMPTY with *slot set to where it would go. */
+static u_int32_t find_chaddr(const unsigned char *chaddr, u_int32_t *slot) {
+    u_int32_t start = hash_chaddr(chaddr) & index_mask;
+    for (u_int32_t i = 0; i <= index_mask; i++) {
+        u_int32_t position = (start + i) & index_mask;
+        u_int32_t entry = atomic_load_explicit(&chaddr_index[position], memory_order_acquire);
+        if (entry == EMPTY) {
+            *slot = position;
+            return EMPTY;
+        }
+        /* a record's hardware address only changes under chaddr_version, which readers check */
+        if (memcmp(records[entry - 1].chaddr, chaddr, LEASE_HLEN) == 0) return entry;
+    }
+    return EMPTY;
+}
+
+struct lease *lease_find(const unsigned char *chaddr) {
+    u_int32_t slot, entry = find_chaddr(chaddr, &slot);
+    return entry == EMPTY ? NULL : &records[entry - 1];
+}
+
+static u_int32_t chaddr_home(u_int32_t entry) {
+    return hash_chaddr(records[entry - 1].chaddr) & index_mask;
+}
+
+static u_int32_t address_home(u_int32_t entry) {
+    return hash_address(records[entry - 1].addr) & index_mask;
+}
+
+/*
+ * Take entry out of an index, probing from hole, by shifting the rest of its
+ * probe run back over it (backward shift deletion), so the index never
+ * collects tombstones and probe runs stay as short under churn as on a fresh
+ * table. Readers retry if the version moved while they probed; a caller that
+ * already holds a version odd passes NULL. Returns whether entry was there.
+ */
+static int unindex(_Atomic u_int32_t *index, _Atomic u_int32_t *version, u_int32_t hole, u_int32_t entry,
+                   u_int32_t (*home_of)(u_int32_t)) {
+    while (1) {
+        u_int32_t current = atomic_load_explicit(&index[hole], memory_order_relaxed);
+        if (current == EMPTY) return 0;
+        if (current == entry) break;
+        hole = (hole + 1) & index_mask;
+    }
+
+    if (version) {
+        atomic_fetch_add_explicit(version, 1, memory_order_relaxed);
+        atomic_thread_fence(memory_order_release);
+    }
+    for (u_int32_t next = (hole + 1) & index_mask;; next = (next + 1) & index_mask) {
+        u_int32_t current = atomic_load_explicit(&index[next], memory_order_relaxed);
+        if (current == EMPTY) break;
+        /* an entry moves back unless its home slot lies after the hole, up to where it sits */
+        u_int32_t home = home_of(current);
+        if (((next - home) & index_mask) >= ((next - hole) & index_mask)) {
+            atomic_store_explicit(&index[hole], current, memory_order_relaxed);
+            hole = next;
+        }
+    }
+    atomic_store_explicit(&index[hole], EMPTY, memory_order_relaxed);
+    if (version) atomic_fetch_add_explicit(version, 1, memory_order_release);
+    return 1;
+}
+
+static int unindex_address(struct in_addr addr, u_int32_t entry) {
+    return unindex(address_index, &address_version, hash_address(addr) & index_mask, entry, address_home);
+}
+
+/* Point addr at entry, over the slot of a lease that held addr before if there is one. */
+static void index_address(struct in_addr addr, u_int32_t entry) {
+    for (u_int32_t position = hash_address(addr) & index_mask;; position = (position + 1) & index_mask) {
+        _Atomic u_int32_t *slot = &address_index[position];
+        u_int32_t current = atomic_load_explicit(slot, memory_order_relaxed);
+        if (current == EMPTY || records[current - 1].addr.s_addr == addr.s_addr) {
+            atomic_store_explicit(slot, entry, memory_order_release);
+            return;
+        }
+    }
+}
+
+/* Write a record that readers may be looking at, under its stripe's sequence counter. */
+static void write_lease(u_int32_t entry, const unsigned char *chaddr, struct in_addr addr, u_int32_t expiry) {
+    struct lease *lease = &records[entry - 1];
+    _Atomic u_int32_t *version = &versions[(entry - 1) / LEASE_STRIPE];
+    atomic_fetch_add_explicit(version, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    if (chaddr) memcpy(lease->chaddr, chaddr, LEASE_HLEN);
+    lease->addr = addr;
+    lease->expiry = expiry;
+    atomic_fetch_add_explicit(version, 1, memory_order_release);
+}
+
+/*
+ * Record number + 1 of an expired lease to hand to a new client once the
+ * arena is full: the one that held addr if it has expired, so the address
+ * changes hands with its record, else the next expired one from where the
+ * last walk stopped. A lease still counted against a circuit waits for the
+ * quota sweep to release it. EMPTY if there is none, then the next walk waits
+ * REUSE_RETRY seconds.
+ */
+static u_int32_t reusable_record(struct in_addr addr, u_int32_t now) {
+    for (u_int32_t position = hash_address(addr) & index_mask;; position = (position + 1) & index_mask) {
+        u_int32_t entry = atomic_load_explicit(&address_index[position], memory_order_relaxed);
+        if (entry == EMPTY) break;
+        if (records[entry - 1].addr.s_addr == addr.s_addr) {
+            if (records[entry - 1].expiry <= now && records[entry - 1].circuit == 0) return entry;
+            break;
+        }
+    }
+
+    if ((time_t) now < reuse_idle_until) return EMPTY;
+    for (u_int32_t i = 0; i < max_count; i++) {
+        u_int32_t index = reuse_cursor;
+        reuse_cursor = (reuse_cursor + 1) % max_count;
+        if (records[index].expiry <= now && records[index].circuit == 0) return index + 1;
+    }
+    reuse_idle_until = (time_t) now + REUSE_RETRY;
+    return EMPTY;
+}
+
+/*
+ * Hand the record of an expired lease to chaddr: out of both indexes, rewrite
+ * it, back in under the new keys. The address it gave up goes to the freed
+ * list unless a newer lease holds it or chaddr takes it over.
+ */
+static struct lease *reuse_record(u_int32_t entry, const unsigned char *chaddr, struct in_addr addr,
+                                  u_int32_t expiry) {
+    struct lease *lease = &records[entry - 1];
+    struct in_addr old = lease->addr;
+
+    atomic_fetch_add_explicit(&chaddr_version, 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    unindex(chaddr_index, NULL, chaddr_home(entry), entry, chaddr_home);
+    int held = unindex_address(old, entry);
+    write_lease(entry, chaddr, addr, expiry);
+    u_int32_t slot;
+    find_chaddr(chaddr, &slot);
+    atomic_store_explicit(&chaddr_index[slot], entry, memory_order_release);
+    atomic_fetch_add_explicit(&chaddr_version, 1, memory_order_release);
+    index_address(addr, entry);
+
+    if (held && old.s_addr != addr.s_addr && freed_count < MAX_FREED) freed[freed_count++] = ntohl(old.s_addr);
+    return lease;
+}
+
+struct lease *lease_update(const unsigned char *chaddr, struct in_addr addr, u_int32_t expiry) {
+    u_int32_t slot, entry = find_chaddr(chaddr, &slot);
+    struct lease *lease;
+
+    if (entry == EMPTY) {
+        u_int32_t used = atomic_load_explicit(&count, memory_order_relaxed);
+        if (used == max_count) {
+            entry = reusable_record(addr, (u_int32_t) time(NULL));
+            if (entry == EMPTY) return NULL;
+            lease = reuse_record(entry, chaddr, addr, expiry);
+            if (ntohl(addr.s_addr) > highest_address) highest_address = ntohl(addr.s_addr);
+            return lease;
+        }
+        /* nobody can see the record before the index does, so it needs no sequence counter */
+        lease = &records[used];
+        memcpy(lease->chaddr, chaddr, LEASE_HLEN);
+        lease->addr = addr;
+        lease->expiry = expiry;
+        atomic_store_explicit(&count, used + 1, memory_order_release);
+        entry = used + 1;
+        atomic_store_explicit(&chaddr_index[slot], entry, memory_order_release);
+        index_address(addr, entry);
+    }
+    else {
+        lease = &records[entry - 1];
+        struct in_addr old = lease->addr;
+        /* out of the index under its old address first, the shift hashes every other record by its own */
+        if (old.s_addr != addr.s_addr) unindex_address(old, entry);
+        write_lease(entry, NULL, addr, expiry);
+
+        if (old.s_addr != addr.s_addr) index_address(addr, entry);
+    }
+
+    if (ntohl(addr.s_addr) > highest_address) highest_address = ntohl(addr.s_addr);
+    return lease;
+}
+
+/* Consistent copy of record number index. */
+static void read_lease(u_int32_t index, struct lease_info *info) {
+    const struct lease *lease = &records[index];
+    _Atomic u_int32_t *version = &versions[index / LEASE_STRIPE];
+    while (1) {
+        u_int32_t before = atomic_load_explicit(version, memory_order_acquire);
+        if (before & 1) continue;
+
+        memcpy(info->chaddr, lease->chaddr, LEASE_HLEN);
+        info->addr = lease->addr;
+        info->expiry = lease->expiry;
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(version, memory_order_relaxed) == before) return;
+    }
+}
+
+int lease_query_chaddr(const unsigned char *chaddr, struct lease_info *info) {
+    while (1) {
+        u_int32_t before = atomic_load_explicit(&chaddr_version, memory_order_acquire);
+        if (before & 1) continue;
+
+        u_int32_t slot, entry = find_chaddr(chaddr, &slot);
+        int result = ERROR;
+        if (entry != EMPTY) {
+            read_lease(entry - 1, info);
+            result = memcmp(info->chaddr, chaddr, LEASE_HLEN) == 0 ? OK : ERROR;
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&chaddr_version, memory_order_relaxed) == before) return result;
+    }
+}
+
+int lease_query_address(struct in_addr addr, struct lease_info *info) {
+    while (1) {
+        u_int32_t before = atomic_load_explicit(&address_version, memory_order_acquire);
+        if (before & 1) continue;
+
+        int result = ERROR;
+        for (u_int32_t position = hash_address(addr) & index_mask;; position = (position + 1) & index_mask) {
+            u_int32_t entry = atomic_load_explicit(&address_index[position], memory_order_acquire);
+            if (entry == EMPTY) break;
+            /* the lease may have moved on since the slot was written */
+            read_lease(entry - 1, info);
+            if (info->addr.s_addr == addr.s_addr) {
+                result = OK;
+                break;
+            }
+        }
+
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&address_version, memory_order_relaxed) == before) return result;
+    }
+}
+
+struct lease *lease_next(u_int32_t *index) {
+    return *index < atomic_load_explicit(&count, memory_order_relaxed) ? &records[(*index)++] : NULL;
+}
+
+u_int32_t lease_index(const struct lease *lease) {
+    return (u_int32_t) (lease - records);
+}
+
+u_int32_t lease_count(void) {
+    return atomic_load_explicit(&count, memory_order_relaxed);
+}
+
+u_int32_t lease_capacity(void) {
+    return max_count;
+}
+
+u_int32_t lease_highest_address(void) {
+    return highest_address;
+}
+
+int lease_take_freed(struct in_addr *addr) {
+    if (freed_count == 0) return ERROR;
+    addr->s_addr = htonl(freed[--freed_count]);
+    return OK;
+}
+
+int lease_format(char *buffer, size_t size) {
+    u_int32_t leases = atomic_load_explicit(&count, memory_order_acquire);
+    /* records and counters are committed a page at a time as they fill, each lease lands on a random index page */
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t record_bytes = ((size_t) leases * sizeof(*records) + page - 1) / page * page;
+    size_t version_bytes = ((size_t) leases / LEASE_STRIPE * sizeof(*versions) + page) / page * page;
+    size_t index_pages = ((size_t) index_mask + 1) * sizeof(*chaddr_index) / page;
+    size_t index_bytes = 2 * (leases < index_pages ? leases : index_pages) * page;
+    size_t total = record_bytes + version_bytes + index_bytes;
+    int length = snprintf(buffer, size, " leases=%u lease_bytes=%zu", leases, total);
+    return length >= (int) size ? (int) size - 1 : length;
+}
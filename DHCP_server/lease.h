@@ -0,0 +1,75 @@
+#ifndef DHCP_SERVER_LEASE_H
+#define DHCP_SERVER_LEASE_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define LEASE_HLEN 6
+#define DEFAULT_MAX_LEASES 65536
+#define MAX_LEASE_LIMIT (1 << 28)    /* largest max_leases, record numbers stay clear of the index markers */
+#define LEASE_STRIPE 64              /* records sharing one sequence counter */
+
+/*
+ * Leases are 16 byte records handed out in order from an arena reserved for
+ * max_leases of them. Pages are only committed as records are written, so
+ * memory follows the leases actually held. A record never moves, so a struct
+ * lease pointer stays valid for the life of the server and a walk over all
+ * leases (expiry sweep, resync, handoff) is one sequential scan of dense
+ * memory. Once the arena is full a new client takes over the record of an
+ * expired lease that no longer counts against a circuit. Two open addressing
+ * indexes of 32-bit record numbers, by hardware address and by address, find
+ * a record in O(1); each has 1.5 to 3 slots per lease, so a table at its
+ * limit costs 28 to 40 bytes a lease.
+ *
+ * The packet thread is the only writer. Other threads read through
+ * lease_query_chaddr() and lease_query_address(), which never take a lock:
+ * every LEASE_STRIPE records share a sequence counter that is odd while one
+ * of them is being written, and a reader retries if the counter moved under it.
+ */
+struct lease {
+    unsigned char chaddr[LEASE_HLEN];
+    u_int16_t circuit;               /* quota slot + 1 the lease counts against, 0 if none; packet thread only */
+    struct in_addr addr;
+    u_int32_t expiry;                /* wall clock seconds */
+};
+
+struct lease_info {
+    unsigned char chaddr[LEASE_HLEN];
+    struct in_addr addr;
+    u_int32_t expiry;
+};
+
+/* Reserve room for max_leases records. */
+int lease_table_init(u_int32_t max_leases);
+
+/* Lease held by chaddr, expired or not, NULL if the client never had one. */
+struct lease *lease_find(const unsigned char *chaddr);
+
+/* Record that chaddr holds addr until expiry. NULL if the table is full and no lease in it has expired. */
+struct lease *lease_update(const unsigned char *chaddr, struct in_addr addr, u_int32_t expiry);
+
+/* Lock-free lookups for threads other than the packet thread. OK if found, ERROR otherwise. */
+int lease_query_chaddr(const unsigned char *chaddr, struct lease_info *info);
+int lease_query_address(struct in_addr addr, struct lease_info *info);
+
+/* Iterate the table: returns the lease at *index and advances *index, NULL past the last one. */
+struct lease *lease_next(u_int32_t *index);
+
+/* Record number of lease, below lease_count(), for tables kept alongside. */
+u_int32_t lease_index(const struct lease *lease);
+
+/* Leases held so far and the most there can be. */
+u_int32_t lease_count(void);
+u_int32_t lease_capacity(void);
+
+/* Highest address ever leased (host byte order), so the allocator does not hand it out again. */
+u_int32_t lease_highest_address(void);
+
+/* Pop an address that a reused record gave up, for the allocator to hand out again. ERROR if there is none. */
+int lease_take_freed(struct in_addr *addr);
+
+/* Append " leases=<count> lease_bytes=<memory committed for them, about>", returns the length. */
+int lease_format(char *buffer, size_t size);
+
+#endif
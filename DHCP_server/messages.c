@@ -0,0 +1,135 @@
+#define _GNU_SOURCE
+#include "messages.h"
+
+#include <errno.h>
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "metrics.h"
+
+#define OK 0
+#define ERROR -1
+
+#define MESSAGE_PREFIX "Message from client: "
+
+struct message {
+    struct timespec received;
+    char text[MAX_MSG_LENGTH + 1];
+};
+
+static struct message queue[MESSAGE_QUEUE_SIZE];
+static unsigned int queue_head, queue_tail;
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_drained = PTHREAD_COND_INITIALIZER;
+static int printing;                 /* the printer holds a batch taken off the queue */
+
+static int message_sock;
+static pthread_t receiver;
+
+static void receive_timestamp(struct msghdr *header, struct timespec *received) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(header); cmsg; cmsg = CMSG_NXTHDR(header, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            memcpy(received, CMSG_DATA(cmsg), sizeof(*received));
+            return;
+        }
+    }
+    clock_gettime(CLOCK_REALTIME, received);
+}
+
+static void *receive_thread(void *arg) {
+    (void) arg;
+    static char buffers[MESSAGE_BATCH][MAX_MSG_LENGTH];
+    static char controls[MESSAGE_BATCH][CMSG_SPACE(sizeof(struct timespec))];
+    struct mmsghdr headers[MESSAGE_BATCH];
+    struct iovec vectors[MESSAGE_BATCH];
+
+    while (1) {
+        memset(headers, 0, sizeof(headers));
+        for (int i = 0; i < MESSAGE_BATCH; i++) {
+            vectors[i].iov_base = buffers[i];
+            vectors[i].iov_len = MAX_MSG_LENGTH;
+            headers[i].msg_hdr.msg_iov = &vectors[i];
+            headers[i].msg_hdr.msg_iovlen = 1;
+            headers[i].msg_hdr.msg_control = controls[i];
+            headers[i].msg_hdr.msg_controllen = sizeof(controls[i]);
+        }
+
+        int received = recvmmsg(message_sock, headers, MESSAGE_BATCH, MSG_WAITFORONE, NULL);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            perror("Could not receive messages");
+            return NULL;
+        }
+
+        pthread_mutex_lock(&queue_lock);
+        for (int i = 0; i < received; i++) {
+            if (queue_tail - queue_head == MESSAGE_QUEUE_SIZE) {
+                metrics_count_drop(CHANNEL_MESSAGE);
+                continue;
+            }
+            struct message *message = &queue[queue_tail++ % MESSAGE_QUEUE_SIZE];
+            receive_timestamp(&headers[i].msg_hdr, &message->received);
+            memcpy(message->text, buffers[i], headers[i].msg_len);
+            message->text[headers[i].msg_len] = '\0';
+        }
+        pthread_cond_signal(&queue_ready);
+        pthread_mutex_unlock(&queue_lock);
+    }
+}
+
+static void *print_thread(void *arg) {
+    (void) arg;
+    static struct message batch[MESSAGE_QUEUE_SIZE];
+    static char output[MESSAGE_QUEUE_SIZE * (sizeof(MESSAGE_PREFIX) + MAX_MSG_LENGTH)];
+
+    while (1) {
+        pthread_mutex_lock(&queue_lock);
+        while (queue_head == queue_tail) pthread_cond_wait(&queue_ready, &queue_lock);
+        int count = 0;
+        while (queue_head != queue_tail) batch[count++] = queue[queue_head++ % MESSAGE_QUEUE_SIZE];
+        printing = 1;
+        pthread_mutex_unlock(&queue_lock);
+
+        size_t length = 0;
+        for (int i = 0; i < count; i++) {
+            length += snprintf(output + length, sizeof(output) - length, MESSAGE_PREFIX "%s", batch[i].text);
+        }
+        fwrite(output, 1, length, stdout);
+        fflush(stdout);
+
+        for (int i = 0; i < count; i++) metrics_record_latency(CHANNEL_MESSAGE, &batch[i].received);
+
+        pthread_mutex_lock(&queue_lock);
+        printing = 0;
+        pthread_cond_broadcast(&queue_drained);
+        pthread_mutex_unlock(&queue_lock);
+    }
+    return NULL;
+}
+
+int messages_start(int sock) {
+    message_sock = sock;
+    int enable = 1;
+    setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable));
+
+    pthread_t printer;
+    if (pthread_create(&receiver, NULL, receive_thread, NULL) != 0) return ERROR;
+    if (pthread_create(&printer, NULL, print_thread, NULL) != 0) return ERROR;
+    pthread_detach(printer);
+    return OK;
+}
+
+void messages_stop(void) {
+    /* recvmmsg() is a cancellation point, a batch it has returned is always queued first */
+    pthread_cancel(receiver);
+    pthread_join(receiver, NULL);
+
+    pthread_mutex_lock(&queue_lock);
+    while (queue_head != queue_tail || printing) pthread_cond_wait(&queue_drained, &queue_lock);
+    pthread_mutex_unlock(&queue_lock);
+}
@@ -0,0 +1,18 @@
+#ifndef DHCP_SERVER_MESSAGES_H
+#define DHCP_SERVER_MESSAGES_H
+
+#define MAX_MSG_LENGTH     100
+#define MESSAGE_BATCH      32        /* datagrams taken per recvmmsg() call */
+#define MESSAGE_QUEUE_SIZE 256       /* messages waiting to be printed, further ones are dropped */
+
+/*
+ * Client chatter on port 547 is handled away from the DHCP socket: one thread
+ * receives it in batches into a bounded queue, another prints the queue with
+ * one write and one flush per batch. Neither ever waits on the DHCP loop.
+ */
+int messages_start(int sock);
+
+/* Stop receiving and return once everything already received has been printed. */
+void messages_stop(void);
+
+#endif
@@ -0,0 +1,85 @@
+#include "metrics.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <sys/resource.h>
+
+struct latency_histogram {
+    _Atomic unsigned long buckets[LATENCY_BUCKETS];
+    _Atomic unsigned long count;
+    _Atomic unsigned long dropped;
+    _Atomic unsigned long max;       /* microseconds */
+};
+
+static struct latency_histogram histograms[CHANNEL_COUNT];
+static const char *channel_names[CHANNEL_COUNT] = {"dhcp", "message"};
+
+static _Atomic unsigned long deliveries[DELIVERY_COUNT];
+static const char *delivery_names[DELIVERY_COUNT] = {"broadcast", "unicast", "link", "relay"};
+
+void metrics_record_latency(enum metric_channel channel, const struct timespec *received) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);       /* kernel receive timestamps use the wall clock */
+    long micros = (now.tv_sec - received->tv_sec) * 1000000L + (now.tv_nsec - received->tv_nsec) / 1000;
+    if (micros < 0) micros = 0;
+
+    int bucket = 0;
+    while (bucket < LATENCY_BUCKETS - 1 && (1L << bucket) <= micros) bucket++;
+
+    struct latency_histogram *histogram = &histograms[channel];
+    atomic_fetch_add_explicit(&histogram->buckets[bucket], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&histogram->count, 1, memory_order_relaxed);
+    unsigned long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    while ((unsigned long) micros > max &&
+           !atomic_compare_exchange_weak_explicit(&histogram->max, &max, (unsigned long) micros,
+                                                  memory_order_relaxed, memory_order_relaxed));
+}
+
+void metrics_count_drop(enum metric_channel channel) {
+    atomic_fetch_add_explicit(&histograms[channel].dropped, 1, memory_order_relaxed);
+}
+
+void metrics_count_delivery(enum metric_delivery delivery) {
+    atomic_fetch_add_explicit(&deliveries[delivery], 1, memory_order_relaxed);
+}
+
+/* Upper bound of the bucket holding the given fraction of the samples. */
+static unsigned long percentile(struct latency_histogram *histogram, unsigned long count, double fraction) {
+    unsigned long target = (unsigned long) (count * fraction), seen = 0;
+    unsigned long max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        seen += atomic_load_explicit(&histogram->buckets[i], memory_order_relaxed);
+        if (seen > target) return (1UL << i) < max ? 1UL << i : max;
+    }
+    return max;
+}
+
+int metrics_format(char *buffer, size_t size) {
+    int length = 0;
+    for (int channel = 0; channel < CHANNEL_COUNT; channel++) {
+        struct latency_histogram *histogram = &histograms[channel];
+        unsigned long count = atomic_load_explicit(&histogram->count, memory_order_relaxed);
+        length += snprintf(buffer + length, size - length,
+                           "%s%s_count=%lu %s_dropped=%lu %s_p50_us=%lu %s_p99_us=%lu %s_max_us=%lu",
+                           channel ? " " : "", channel_names[channel], count,
+                           channel_names[channel], atomic_load_explicit(&histogram->dropped, memory_order_relaxed),
+                           channel_names[channel], count ? percentile(histogram, count, 0.5) : 0,
+                           channel_names[channel], count ? percentile(histogram, count, 0.99) : 0,
+                           channel_names[channel], atomic_load_explicit(&histogram->max, memory_order_relaxed));
+        if (length >= (int) size) return (int) size - 1;
+    }
+    for (int delivery = 0; delivery < DELIVERY_COUNT; delivery++) {
+        length += snprintf(buffer + length, size - length, " replies_%s=%lu", delivery_names[delivery],
+                           atomic_load_explicit(&deliveries[delivery], memory_order_relaxed));
+        if (length >= (int) size) return (int) size - 1;
+    }
+
+    /* what serving costs, spinning and busy polling show up here */
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    length += snprintf(buffer + length, size - length, " cpu_user_ms=%ld cpu_system_ms=%ld",
+                       usage.ru_utime.tv_sec * 1000L + usage.ru_utime.tv_usec / 1000,
+                       usage.ru_stime.tv_sec * 1000L + usage.ru_stime.tv_usec / 1000);
+    if (length >= (int) size) return (int) size - 1;
+    return length;
+}
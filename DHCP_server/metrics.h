@@ -0,0 +1,31 @@
+#ifndef DHCP_SERVER_METRICS_H
+#define DHCP_SERVER_METRICS_H
+
+#include <stddef.h>
+#include <time.h>
+
+#define LATENCY_BUCKETS 32           /* bucket i holds latencies below 2^i microseconds */
+
+enum metric_channel {
+    CHANNEL_DHCP = 0,                /* kernel receive of a request to its reply being sent */
+    CHANNEL_MESSAGE,                 /* kernel receive of a port 547 message to it being printed */
+    CHANNEL_COUNT
+};
+
+enum metric_delivery {
+    DELIVERY_BROADCAST = 0,          /* to every host on the segment */
+    DELIVERY_UNICAST,                /* to ciaddr of a client renewing its lease */
+    DELIVERY_LINK,                   /* to chaddr in a link-layer frame */
+    DELIVERY_RELAY,                  /* to the relay agent in giaddr */
+    DELIVERY_COUNT
+};
+
+/* Counters and latency histograms, safe to update and read from any thread. */
+void metrics_record_latency(enum metric_channel channel, const struct timespec *received);
+void metrics_count_drop(enum metric_channel channel);
+void metrics_count_delivery(enum metric_delivery delivery);
+
+/* One "key=value ..." line without the newline, ending with the process CPU time. Returns its length. */
+int metrics_format(char *buffer, size_t size);
+
+#endif
@@ -0,0 +1,53 @@
+#ifndef DHCP_SERVER_PROBES_H
+#define DHCP_SERVER_PROBES_H
+
+/*
+ * USDT probes on the packet path, provider dhcp_server. With <sys/sdt.h> each
+ * probe is one nop and an ELF note; bpftrace, perf or stap patch in a
+ * breakpoint only while they are attached, so the probes stay in release
+ * builds. Without the header they compile to nothing.
+ *
+ *   packet_received(xid, chaddr, received_ns)
+ *   options_parsed(xid, chaddr, message_type, received_ns)
+ *   address_allocated(xid, chaddr, address, received_ns)
+ *   address_denied(xid, chaddr, enum probe_denial, received_ns)
+ *   reply_built(xid, chaddr, message_type, length, received_ns)
+ *   reply_sent(xid, chaddr, enum metric_delivery, received_ns)
+ *
+ * xid is in host byte order, chaddr points at the 16 byte client hardware
+ * address and address is in network byte order. received_ns is the kernel
+ * receive time of the request on CLOCK_REALTIME, so a tracer can add the time
+ * spent queued before packet_received to what it measures between probes.
+ *
+ * bpftrace -e 'usdt:./server:dhcp_server:packet_received { @start[arg0] = nsecs }
+ *               usdt:./server:dhcp_server:reply_sent /@start[arg0]/ {
+ *                   @us = hist((nsecs - @start[arg0]) / 1000); delete(@start[arg0]) }'
+ */
+
+enum probe_denial {
+    DENIED_QUOTA = 0,       /* the circuit holds its quota of addresses */
+    DENIED_POOL_EMPTY,      /* no free address, or none probed yet */
+    DENIED_IN_USE,          /* the requested address belongs to another client, NAK */
+    DENIED_WRONG_ADDRESS,   /* the requested address is outside the pool or reserved for another client, NAK */
+    DENIED_TABLE_FULL       /* no lease record free for a new client, no reply */
+};
+
+#if defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define DHCP_PROBES_ENABLED 1
+#endif
+#endif
+
+#ifdef DHCP_PROBES_ENABLED
+#define PROBE_NS(timespec) ((unsigned long long) (timespec).tv_sec * 1000000000ULL + (timespec).tv_nsec)
+#define DHCP_PROBE3(name, a, b, c) DTRACE_PROBE3(dhcp_server, name, a, b, c)
+#define DHCP_PROBE4(name, a, b, c, d) DTRACE_PROBE4(dhcp_server, name, a, b, c, d)
+#define DHCP_PROBE5(name, a, b, c, d, e) DTRACE_PROBE5(dhcp_server, name, a, b, c, d, e)
+#else
+#define DHCP_PROBE3(name, a, b, c) ((void) 0)
+#define DHCP_PROBE4(name, a, b, c, d) ((void) 0)
+#define DHCP_PROBE5(name, a, b, c, d, e) ((void) 0)
+#endif
+
+#endif
@@ -0,0 +1,191 @@
+#define _GNU_SOURCE
+#include "query.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lease.h"
+#include "flood.h"
+#include "metrics.h"
+#include "quota.h"
+#include "xdp_filter.h"
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_ANSWER_LENGTH 1024
+
+struct query_client {
+    int fd;
+    size_t length;
+    char buffer[MAX_QUERY_LENGTH];
+};
+
+static struct query_client clients[MAX_QUERY_CLIENTS];
+
+static int parse_mac(const char *text, unsigned char *chaddr) {
+    unsigned int bytes[LEASE_HLEN];
+    char tail;
+    if (sscanf(text, "%x:%x:%x:%x:%x:%x%c", &bytes[0], &bytes[1], &bytes[2],
+               &bytes[3], &bytes[4], &bytes[5], &tail) != LEASE_HLEN) {
+        return ERROR;
+    }
+    for (int i = 0; i < LEASE_HLEN; i++) {
+        if (bytes[i] > 0xFF) return ERROR;
+        chaddr[i] = (unsigned char) bytes[i];
+    }
+    return OK;
+}
+
+static int format_lease(const struct lease_info *info, char *answer) {
+    char address[INET_ADDRSTRLEN];
+    inet_ntop(AF_INET, &info->addr, address, sizeof(address));
+    return snprintf(answer, MAX_ANSWER_LENGTH, "%s %02x:%02x:%02x:%02x:%02x:%02x %ld\n", address,
+                    info->chaddr[0], info->chaddr[1], info->chaddr[2], info->chaddr[3],
+                    info->chaddr[4], info->chaddr[5], (long) info->expiry - (long) time(NULL));
+}
+
+static int answer_request(char *request, char *answer) {
+    char command[16], argument[MAX_QUERY_LENGTH];
+    struct lease_info info;
+
+    int fields = sscanf(request, "%15s %127s", command, argument);
+    if (fields == 1 && strcmp(command, "stats") == 0) {
+        int length = metrics_format(answer, MAX_ANSWER_LENGTH - 1);
+        length += quota_format(answer + length, MAX_ANSWER_LENGTH - 1 - length);
+        length += flood_format(answer + length, MAX_ANSWER_LENGTH - 1 - length);
+        length += xdp_filter_format(answer + length, MAX_ANSWER_LENGTH - 1 - length);
+        length += lease_format(answer + length, MAX_ANSWER_LENGTH - 1 - length);
+        answer[length++] = '\n';
+        return length;
+    }
+    if (fields != 2) return snprintf(answer, MAX_ANSWER_LENGTH, "error\n");
+
+    if (strcmp(command, "ip") == 0) {
+        struct in_addr addr;
+        if (!inet_aton(argument, &addr)) return snprintf(answer, MAX_ANSWER_LENGTH, "error\n");
+        if (lease_query_address(addr, &info) == ERROR) return snprintf(answer, MAX_ANSWER_LENGTH, "none\n");
+        return format_lease(&info, answer);
+    }
+    if (strcmp(command, "mac") == 0) {
+        unsigned char chaddr[LEASE_HLEN];
+        if (parse_mac(argument, chaddr) == ERROR) return snprintf(answer, MAX_ANSWER_LENGTH, "error\n");
+        if (lease_query_chaddr(chaddr, &info) == ERROR) return snprintf(answer, MAX_ANSWER_LENGTH, "none\n");
+        return format_lease(&info, answer);
+    }
+    return snprintf(answer, MAX_ANSWER_LENGTH, "error\n");
+}
+
+/*
+ * The client fds are non-blocking so that one client that stops reading cannot
+ * stall the others. A send the socket buffer cannot take whole drops the client.
+ */
+static int send_answers(struct query_client *client, const char *answers, size_t length) {
+    ssize_t sent = send(client->fd, answers, length, MSG_NOSIGNAL);
+    return sent == (ssize_t) length ? OK : ERROR;
+}
+
+/* Answer every complete line in the client's buffer. ERROR if the client should be dropped. */
+static int serve_client(struct query_client *client) {
+    ssize_t received = recv(client->fd, client->buffer + client->length,
+                            sizeof(client->buffer) - client->length, MSG_DONTWAIT);
+    if (received == 0) return ERROR;
+    if (received < 0) return (errno == EAGAIN || errno == EINTR) ? OK : ERROR;
+    client->length += received;
+
+    char answers[4096];
+    size_t answers_length = 0, consumed = 0;
+    char *newline;
+    while ((newline = memchr(client->buffer + consumed, '\n', client->length - consumed)) != NULL) {
+        *newline = '\0';
+        if (answers_length + MAX_ANSWER_LENGTH > sizeof(answers)) {
+            if (send_answers(client, answers, answers_length) == ERROR) return ERROR;
+            answers_length = 0;
+        }
+        answers_length += answer_request(client->buffer + consumed, answers + answers_length);
+        consumed = newline - client->buffer + 1;
+    }
+    if (consumed == 0 && client->length == sizeof(client->buffer)) return ERROR;     /* line too long */
+
+    memmove(client->buffer, client->buffer + consumed, client->length - consumed);
+    client->length -= consumed;
+    if (answers_length > 0 && send_answers(client, answers, answers_length) == ERROR) return ERROR;
+    return OK;
+}
+
+static void *query_thread(void *arg) {
+    int listener = *(int *) arg;
+    struct pollfd fds[MAX_QUERY_CLIENTS + 1];
+
+    while (1) {
+        int count = 0;
+        fds[count].fd = listener;
+        fds[count++].events = POLLIN;
+        for (int i = 0; i < MAX_QUERY_CLIENTS; i++) {
+            fds[count].fd = clients[i].fd;
+            fds[count++].events = POLLIN;
+        }
+
+        if (poll(fds, count, -1) < 0) continue;
+
+        for (int i = 0; i < MAX_QUERY_CLIENTS; i++) {
+            if (clients[i].fd < 0 || !(fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+            if (serve_client(&clients[i]) == ERROR) {
+                close(clients[i].fd);
+                clients[i].fd = -1;
+            }
+        }
+
+        if (fds[0].revents & POLLIN) {
+            int fd = accept4(listener, NULL, NULL, SOCK_NONBLOCK);
+            if (fd < 0) continue;
+            int i;
+            for (i = 0; i < MAX_QUERY_CLIENTS && clients[i].fd >= 0; i++);
+            if (i == MAX_QUERY_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            clients[i].fd = fd;
+            clients[i].length = 0;
+        }
+    }
+    return NULL;
+}
+
+int query_start(const char *path) {
+    static int listener;
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0) {
+        perror("Could not create query socket");
+        return ERROR;
+    }
+
+    struct sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(address.sun_path)) return ERROR;
+    strcpy(address.sun_path, path);
+    unlink(path);
+    if (bind(listener, (struct sockaddr *) &address, sizeof(address)) < 0 || listen(listener, 16) < 0) {
+        printf("\tCould not bind query socket %s\n", path);
+        close(listener);
+        return ERROR;
+    }
+
+    for (int i = 0; i < MAX_QUERY_CLIENTS; i++) clients[i].fd = -1;
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, query_thread, &listener) != 0) return ERROR;
+    pthread_detach(thread);
+
+    printf("Lease queries on %s\n", path);
+    return OK;
+}
@@ -0,0 +1,21 @@
+#ifndef DHCP_SERVER_QUERY_H
+#define DHCP_SERVER_QUERY_H
+
+#define MAX_QUERY_CLIENTS 64
+#define MAX_QUERY_LENGTH  128
+
+/*
+ * Lease query service on a Unix stream socket, served from its own thread.
+ * One request per line, one answer per line:
+ *
+ *     ip 10.0.2.120              ->  10.0.2.120 aa:bb:cc:dd:ee:ff 97
+ *     mac aa:bb:cc:dd:ee:ff      ->  10.0.2.120 aa:bb:cc:dd:ee:ff 97
+ *     stats                      ->  dhcp_count=12 dhcp_dropped=0 dhcp_p50_us=64 ...
+ *
+ * The last field is the number of seconds left on the lease (negative once it
+ * has expired). Unknown leases answer "none", malformed requests "error".
+ * A client whose answers no longer fit in its socket buffer is disconnected.
+ */
+int query_start(const char *path);
+
+#endif
@@ -0,0 +1,136 @@
+#include "quota.h"
+#include "reservation.h"
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <time.h>
+
+struct circuit {
+    u_int64_t key;                   /* 0 if the slot is free */
+    u_int32_t active;
+};
+
+static struct circuit circuits[QUOTA_CIRCUITS + 1];   /* the last one is the overflow circuit */
+static _Atomic int circuit_count;
+static _Atomic unsigned long refused;
+
+static u_int32_t counted;            /* leases counted against some circuit */
+static long last_sweep;
+static u_int32_t sweep_cursor;
+
+/* FNV-1a over the sub-option bytes, the two ids are kept apart by their codes and lengths */
+static u_int64_t circuit_key(const unsigned char *option) {
+    u_int64_t key = 0xCBF29CE484222325ULL;
+    for (int i = 0; i + 2 <= option[1]; i += 2 + option[3 + i]) {
+        u_int8_t code = option[2 + i], length = option[3 + i];
+        if (i + 2 + length > option[1]) break;
+        if (code != RELAY_CIRCUIT_ID && code != RELAY_REMOTE_ID) continue;
+        for (int j = 0; j < 2 + length; j++) key = (key ^ option[2 + i + j]) * 0x100000001B3ULL;
+    }
+    return key ? key : 1;
+}
+
+int quota_circuit(const DHCP_packet *packet) {
+    if (packet->giaddr.s_addr == 0) return 0;
+    const unsigned char *option = dhcp_find_option(packet, OPTION_RELAY_AGENT);
+    if (option == NULL) return 0;
+
+    u_int64_t key = circuit_key(option);
+    u_int32_t slot = (u_int32_t) reservation_hash(key, 0);
+    struct circuit *idle = NULL;
+    for (int probe = 0; probe < QUOTA_MAX_PROBES; probe++) {
+        struct circuit *circuit = &circuits[(slot + probe) & (QUOTA_CIRCUITS - 1)];
+        if (circuit->key == key) return (int) (circuit - circuits) + 1;
+        if (circuit->key == 0) {
+            if (idle == NULL) {
+                idle = circuit;
+                atomic_fetch_add_explicit(&circuit_count, 1, memory_order_relaxed);
+            }
+            break;
+        }
+        /* no lease points at a circuit without active ones, and probing goes on past a reused slot */
+        if (circuit->active == 0 && idle == NULL) idle = circuit;
+    }
+    if (idle == NULL) return QUOTA_OVERFLOW;
+    idle->key = key;
+    return (int) (idle - circuits) + 1;
+}
+
+int quota_allows(int circuit, const struct lease *lease, int max) {
+    if (circuit == 0 || max == 0) return 1;
+    /* a client renewing on its own circuit is already counted */
+    if (lease && lease->circuit == circuit && lease->expiry > (u_int32_t) time(NULL)) return 1;
+    if (circuits[circuit - 1].active < (u_int32_t) max) return 1;
+    atomic_fetch_add_explicit(&refused, 1, memory_order_relaxed);
+    return 0;
+}
+
+void quota_assign(struct lease *lease, int circuit) {
+    if (lease->circuit == circuit) return;
+    quota_release(lease);
+    if (circuit) {
+        circuits[circuit - 1].active++;
+        counted++;
+    }
+    lease->circuit = (u_int16_t) circuit;
+}
+
+void quota_release(struct lease *lease) {
+    if (lease->circuit == 0) return;
+    circuits[lease->circuit - 1].active--;
+    counted--;
+    lease->circuit = 0;
+}
+
+void quota_expire(long now) {
+    if (last_sweep == 0 || counted == 0) last_sweep = now;
+    long elapsed = now - last_sweep;
+    u_int32_t total = lease_count();
+    u_int32_t due = elapsed >= QUOTA_SWEEP_INTERVAL ? total
+                                                    : (u_int32_t) (elapsed * total / QUOTA_SWEEP_INTERVAL);
+    if (due == 0) return;
+    /* after a quiet spell the rest of the backlog waits for the next calls */
+    last_sweep = due > QUOTA_SWEEP_SLICE ? now - (long) (due - QUOTA_SWEEP_SLICE) * QUOTA_SWEEP_INTERVAL / total : now;
+    if (due > QUOTA_SWEEP_SLICE) due = QUOTA_SWEEP_SLICE;
+
+    u_int32_t seconds = (u_int32_t) time(NULL);
+    for (u_int32_t i = 0; i < due; i++) {
+        struct lease *lease = lease_next(&sweep_cursor);
+        if (lease == NULL) {
+            sweep_cursor = 0;
+            lease = lease_next(&sweep_cursor);
+        }
+        if (lease->circuit && lease->expiry <= seconds) quota_release(lease);
+    }
+}
+
+long quota_wait(long now) {
+    if (counted == 0) return -1;
+    u_int32_t total = lease_count();
+    long slice = QUOTA_SWEEP_INTERVAL;
+    if (total > QUOTA_SWEEP_SLICE) slice = (long) QUOTA_SWEEP_SLICE * QUOTA_SWEEP_INTERVAL / total;
+    if (slice < 1) slice = 1;
+    long wait = last_sweep + slice - now;
+    return wait < 0 ? 0 : wait;
+}
+
+void quota_export(u_int64_t keys[QUOTA_CIRCUITS + 1]) {
+    for (int i = 0; i <= QUOTA_CIRCUITS; i++) keys[i] = circuits[i].key;
+}
+
+/* Counts start at zero, quota_assign() adds each lease as it arrives. */
+void quota_import(const u_int64_t keys[QUOTA_CIRCUITS + 1]) {
+    int count = 0;
+    for (int i = 0; i < QUOTA_CIRCUITS; i++) {
+        circuits[i].key = keys[i];
+        circuits[i].active = 0;
+        count += keys[i] != 0;
+    }
+    atomic_store(&circuit_count, count);
+}
+
+int quota_format(char *buffer, size_t size) {
+    int length = snprintf(buffer, size, " quota_circuits=%d quota_refused=%lu", atomic_load(&circuit_count),
+                          atomic_load(&refused));
+    return length >= (int) size ? (int) size - 1 : length;
+}
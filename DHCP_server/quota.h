@@ -0,0 +1,54 @@
+#ifndef DHCP_SERVER_QUOTA_H
+#define DHCP_SERVER_QUOTA_H
+
+#include <stddef.h>
+
+#include "../common/dhcp.h"
+#include "lease.h"
+
+#define QUOTA_CIRCUITS 4096          /* power of two, below 65536 */
+#define QUOTA_OVERFLOW (QUOTA_CIRCUITS + 1)  /* circuit of every request whose circuit finds no slot */
+#define QUOTA_MAX_PROBES 16
+#define QUOTA_SWEEP_INTERVAL 1000    /* milliseconds to walk the whole lease table for expiries */
+#define QUOTA_SWEEP_SLICE 4096       /* most leases one call looks at, a few microseconds */
+
+#define RELAY_CIRCUIT_ID 1           /* option 82 sub-options */
+#define RELAY_REMOTE_ID  2
+
+/*
+ * Active leases per relay circuit, from the circuit-id and remote-id in option
+ * 82. Option 82 is only trusted from a relay (giaddr set, RFC 3046 2.1), a
+ * directly attached client could make up a new circuit per packet. Circuits
+ * live in a fixed open addressing table of counters, so a quota check is a
+ * hash and a few probes; a circuit with no active lease gives its slot up to
+ * the next new one. When the probes find no slot the request counts against
+ * one shared overflow circuit, so a flood of made-up circuits meets a quota
+ * instead of none. A lease remembers the circuit it is counted against; the
+ * count moves on an ACK, drops on a RELEASE, and drops when a sweep that walks
+ * the lease table once a second finds it expired. Packet thread only.
+ */
+
+/* Counter slot + 1 for the circuit of a request, QUOTA_OVERFLOW if none is free, 0 if not relayed with option 82. */
+int quota_circuit(const DHCP_packet *packet);
+
+/* Whether a client holding lease (or NULL) may take an address on circuit, with at most max per circuit. */
+int quota_allows(int circuit, const struct lease *lease, int max);
+
+/* Count lease against circuit after it was granted. */
+void quota_assign(struct lease *lease, int circuit);
+void quota_release(struct lease *lease);
+
+/* Release expired leases, the share of the table due since the last call but at most QUOTA_SWEEP_SLICE. */
+void quota_expire(long now);
+
+/* Milliseconds until quota_expire() has a slice to sweep, -1 while no lease counts against a circuit. */
+long quota_wait(long now);
+
+/* Copy the circuit table out and in, for a handoff: the key of every slot, 0 if free. */
+void quota_export(u_int64_t keys[QUOTA_CIRCUITS + 1]);
+void quota_import(const u_int64_t keys[QUOTA_CIRCUITS + 1]);
+
+/* Append " quota_circuits=.. quota_refused=.." and return the length. */
+int quota_format(char *buffer, size_t size);
+
+#endif
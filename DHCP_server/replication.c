@@ -0,0 +1,402 @@
+#include "replication.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+#define REPLICATION_MAGIC 0x44485250    /* "DHRP" */
+#define MAX_BATCH_RECORDS 64
+#define QUEUE_SIZE 4096
+#define STATS_INTERVAL 10000            /* milliseconds between stats lines while there is traffic */
+
+struct replication_header {
+    u_int32_t magic;
+    u_int32_t instance;                 /* random id of the sender, changes on restart */
+    u_int32_t ack_instance;             /* instance whose changes ack_seq acknowledges */
+    u_int32_t ack_seq;                  /* all of that instance's changes up to here are applied */
+    u_int32_t from_seq;                 /* earlier batches covered every change up to here */
+    u_int32_t to_seq;                   /* this batch covers every change up to here */
+    u_int32_t stamp;                    /* sender clock in milliseconds, echoed back for lag */
+    u_int32_t echo_stamp;
+    u_int16_t count;
+    u_int8_t active;
+    u_int8_t pad;
+} __attribute__((packed));
+
+struct replication_record {
+    unsigned char chaddr[LEASE_HLEN];
+    u_int32_t addr;
+    u_int32_t expiry;
+} __attribute__((packed));
+
+struct queued_change {
+    struct lease *lease;
+    u_int32_t seq;                      /* skipped if the lease changed again since */
+    u_int32_t noted;                    /* milliseconds when the change was made */
+};
+
+struct replication_message {
+    struct replication_header header;
+    struct replication_record records[MAX_BATCH_RECORDS];
+};
+
+static int sock = -1;
+static struct sockaddr_in peer;
+static int active, configured_active;
+static long failover_timeout;
+static u_int32_t instance;
+
+static u_int32_t local_seq;             /* last change number given to a local change */
+static u_int32_t sent_seq;              /* every change up to here has been sent at least once */
+static u_int32_t peer_acked;            /* every change up to here is applied by the peer */
+static long last_ack_progress, last_resync, last_sent, first_queued;
+
+static u_int32_t *change_seqs;          /* per lease record: local change number, 0 if the change came from the peer */
+
+static struct queued_change queue[QUEUE_SIZE];
+static u_int32_t queue_head, queue_tail;
+static int queue_overflow;
+
+static u_int32_t peer_instance;
+static u_int32_t received_seq;
+static u_int32_t echo_stamp;
+static int ack_due;
+static long last_heard;
+
+static struct replication_stats stats;
+static struct replication_stats reported;
+static long last_report;
+
+static u_int32_t *change_seq(const struct lease *lease) {
+    return &change_seqs[lease_index(lease)];
+}
+
+int replication_open(struct in_addr listen_ip, in_port_t port, struct sockaddr_in peer_address,
+                     int start_active, long timeout, int handed_sock) {
+    change_seqs = calloc(lease_capacity(), sizeof(*change_seqs));
+    if (change_seqs == NULL) {
+        printf("Could not allocate the replication change numbers\n");
+        return ERROR;
+    }
+
+    sock = handed_sock;
+    if (sock < 0) {
+        sock = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+        if (sock < 0) {
+            perror("Could not create replication socket");
+            return ERROR;
+        }
+
+        struct sockaddr_in address;
+        memset(&address, 0, sizeof(address));
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr = listen_ip;
+        if (bind(sock, (struct sockaddr *) &address, sizeof(address)) < 0) {
+            printf("\tCould not bind replication socket (port %d)!\n", port);
+            close(sock);
+            return sock = ERROR;
+        }
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    /* from the kernel, reseeding rand() would change the sequence the rest of the server draws from */
+    if (getrandom(&instance, sizeof(instance), 0) != sizeof(instance)) {
+        unsigned int seed = (unsigned int) (now.tv_nsec ^ getpid());
+        instance = ((u_int32_t) rand_r(&seed) << 1) ^ (u_int32_t) rand_r(&seed);
+    }
+    if (instance == 0) instance = 1;
+
+    peer = peer_address;
+    active = configured_active = start_active;
+    failover_timeout = timeout;
+    last_heard = now.tv_sec * 1000L + now.tv_nsec / 1000000;
+
+    printf("Replicating leases to %s:%d as %s\n", inet_ntoa(peer.sin_addr), ntohs(peer.sin_port),
+           active ? "active" : "standby");
+    return sock;
+}
+
+int replication_is_active(void) {
+    return sock < 0 || active;
+}
+
+void replication_note(struct lease *lease) {
+    if (sock < 0) return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    *change_seq(lease) = ++local_seq;
+    if (queue_tail - queue_head == QUEUE_SIZE) {
+        queue_overflow = 1;                 /* the resync scan will pick it up */
+        return;
+    }
+    queue[queue_tail % QUEUE_SIZE].lease = lease;
+    queue[queue_tail % QUEUE_SIZE].seq = local_seq;
+    queue[queue_tail % QUEUE_SIZE].noted = (u_int32_t) (now.tv_sec * 1000L + now.tv_nsec / 1000000);
+    queue_tail++;
+}
+
+/* stamp is when the oldest change in the batch was made, the peer echoes it back in its ack */
+static void send_message(struct replication_message *message, int count, u_int32_t from_seq,
+                         u_int32_t to_seq, u_int32_t stamp, long now) {
+    struct replication_header *header = &message->header;
+    header->magic = htonl(REPLICATION_MAGIC);
+    header->instance = htonl(instance);
+    header->ack_instance = htonl(peer_instance);
+    header->ack_seq = htonl(received_seq);
+    header->from_seq = htonl(from_seq);
+    header->to_seq = htonl(to_seq);
+    header->stamp = htonl(stamp);
+    header->echo_stamp = htonl(echo_stamp);
+    header->count = htons((u_int16_t) count);
+    header->active = (u_int8_t) active;
+    header->pad = 0;
+
+    size_t size = sizeof(*header) + count * sizeof(struct replication_record);
+    sendto(sock, message, size, 0, (struct sockaddr *) &peer, sizeof(peer));
+
+    echo_stamp = 0;
+    ack_due = 0;
+    last_sent = now;
+    if (count > 0) {
+        if (peer_acked == sent_seq) last_ack_progress = now;
+        sent_seq = to_seq;
+        stats.batches_sent++;
+        stats.records_sent += count;
+    }
+}
+
+static void add_record(struct replication_message *message, int index, const struct lease *lease) {
+    struct replication_record *record = &message->records[index];
+    memcpy(record->chaddr, lease->chaddr, LEASE_HLEN);
+    record->addr = lease->addr.s_addr;
+    record->expiry = htonl(lease->expiry);
+}
+
+/* Send the queued changes in order, MAX_BATCH_RECORDS to a datagram. */
+static void flush_queue(long now) {
+    struct replication_message message;
+    int count = 0;
+    u_int32_t from_seq = sent_seq, to_seq = sent_seq, stamp = 0;
+
+    while (queue_head != queue_tail) {
+        struct queued_change *change = &queue[queue_head++ % QUEUE_SIZE];
+        if (*change_seq(change->lease) != change->seq) continue;
+
+        if (count == 0) stamp = change->noted;
+        add_record(&message, count++, change->lease);
+        to_seq = change->seq;
+        if (count == MAX_BATCH_RECORDS) {
+            send_message(&message, count, from_seq, to_seq, stamp, now);
+            from_seq = to_seq;
+            count = 0;
+        }
+    }
+    if (count > 0) send_message(&message, count, from_seq, to_seq, stamp, now);
+}
+
+static int compare_seq(const void *a, const void *b) {
+    u_int32_t x = *change_seq(*(struct lease *const *) a), y = *change_seq(*(struct lease *const *) b);
+    return x < y ? -1 : x > y;
+}
+
+/* Send every lease changed since the peer's last ack, in change order. */
+static void resync(long now) {
+    struct lease **changed = malloc((lease_count() + 1) * sizeof(*changed));
+    if (changed == NULL) return;
+
+    u_int32_t count = 0, index = 0;
+    struct lease *lease;
+    while ((lease = lease_next(&index)) != NULL) {
+        if (*change_seq(lease) > peer_acked) changed[count++] = lease;
+    }
+    qsort(changed, count, sizeof(*changed), compare_seq);
+
+    queue_head = queue_tail = 0;
+    queue_overflow = 0;
+    sent_seq = peer_acked;
+    last_resync = now;
+    stats.resyncs++;
+
+    struct replication_message message;
+    int batch = 0;
+    u_int32_t from_seq = peer_acked;
+    for (u_int32_t i = 0; i < count; i++) {
+        add_record(&message, batch++, changed[i]);
+        if (batch == MAX_BATCH_RECORDS || i == count - 1) {
+            send_message(&message, batch, from_seq, *change_seq(changed[i]), (u_int32_t) now, now);
+            from_seq = *change_seq(changed[i]);
+            batch = 0;
+        }
+    }
+    free(changed);
+}
+
+static void apply(const struct replication_message *message, int count) {
+    for (int i = 0; i < count; i++) {
+        const struct replication_record *record = &message->records[i];
+        struct in_addr addr;
+        addr.s_addr = record->addr;
+        struct lease *lease = lease_update(record->chaddr, addr, ntohl(record->expiry));
+        if (lease) *change_seq(lease) = 0;
+    }
+    stats.records_applied += count;
+}
+
+/* A new peer instance knows nothing we sent before, so every lease counts as changed again. */
+static void meet_peer(u_int32_t new_instance) {
+    peer_instance = new_instance;
+    received_seq = 0;
+    peer_acked = 0;
+    sent_seq = 0;
+
+    u_int32_t index = 0;
+    struct lease *lease;
+    while ((lease = lease_next(&index)) != NULL) *change_seq(lease) = ++local_seq;
+    queue_head = queue_tail = 0;
+    queue_overflow = local_seq > 0;
+}
+
+void replication_receive(long now) {
+    struct replication_message message;
+    while (1) {
+        struct sockaddr_in from;
+        socklen_t from_length = sizeof(from);
+        ssize_t received = recvfrom(sock, &message, sizeof(message), 0, (struct sockaddr *) &from, &from_length);
+        if (received < 0) {
+            if (errno == EINTR) continue;
+            return;
+        }
+        /* only the configured peer may change our leases or reset its sequence */
+        if (from.sin_addr.s_addr != peer.sin_addr.s_addr || from.sin_port != peer.sin_port) {
+            stats.foreign_dropped++;
+            continue;
+        }
+        if (received < (ssize_t) sizeof(message.header)) continue;
+
+        struct replication_header *header = &message.header;
+        int count = ntohs(header->count);
+        if (ntohl(header->magic) != REPLICATION_MAGIC || count > MAX_BATCH_RECORDS) continue;
+        if (received != (ssize_t) (sizeof(*header) + count * sizeof(struct replication_record))) continue;
+
+        u_int32_t sender = ntohl(header->instance);
+        if (sender == instance) continue;
+        if (sender != peer_instance) meet_peer(sender);
+        last_heard = now;
+
+        if (header->active && active && !configured_active) {
+            printf("Active peer is back, returning to standby\n");
+            fflush(stdout);
+            active = 0;
+        }
+
+        if (count > 0) {
+            /* a batch after a lost one is dropped, the peer resends from our ack */
+            if (ntohl(header->from_seq) <= received_seq) {
+                apply(&message, count);
+                if (ntohl(header->to_seq) > received_seq) received_seq = ntohl(header->to_seq);
+                echo_stamp = ntohl(header->stamp);
+            }
+            ack_due = 1;
+        }
+
+        if (ntohl(header->ack_instance) == instance) {
+            u_int32_t acked = ntohl(header->ack_seq);
+            if (acked > peer_acked && acked <= sent_seq) {
+                peer_acked = acked;
+                last_ack_progress = now;
+            }
+            u_int32_t stamp = ntohl(header->echo_stamp);
+            if (stamp != 0) {
+                unsigned long lag = (u_int32_t) now - stamp;
+                stats.lag_samples++;
+                stats.lag_total += lag;
+                if (lag > stats.lag_max) stats.lag_max = lag;
+            }
+        }
+    }
+}
+
+static void report(long now) {
+    long elapsed = now - last_report;
+    if (elapsed < STATS_INTERVAL) return;
+    last_report = now;
+    if (memcmp(&stats, &reported, sizeof(stats)) == 0) return;
+
+    unsigned long samples = stats.lag_samples - reported.lag_samples;
+    unsigned long sent = stats.records_sent - reported.records_sent;
+    printf("Replication: sent %lu leases (%lu/s) in %lu batches, applied %lu, %lu resyncs", sent,
+           sent * 1000 / elapsed, stats.batches_sent - reported.batches_sent,
+           stats.records_applied - reported.records_applied, stats.resyncs - reported.resyncs);
+    if (stats.foreign_dropped != reported.foreign_dropped) {
+        printf(", %lu from strangers dropped", stats.foreign_dropped - reported.foreign_dropped);
+    }
+    if (samples > 0) {
+        printf(", lag avg %lu ms max %lu ms", (stats.lag_total - reported.lag_total) / samples, stats.lag_max);
+    }
+    puts("");
+    fflush(stdout);
+    reported = stats;
+}
+
+void replication_run(long now) {
+    if (sock < 0) return;
+
+    if (!active && now - last_heard > failover_timeout) {
+        printf("Peer is silent for %ld ms, taking over\n", now - last_heard);
+        fflush(stdout);
+        active = 1;
+        stats.takeovers++;
+    }
+
+    if (queue_overflow || (sent_seq > peer_acked && now - last_ack_progress > REPLICATION_RESEND &&
+                           now - last_resync > REPLICATION_RESEND)) {
+        resync(now);
+    }
+
+    if (queue_head != queue_tail) {
+        if (first_queued == 0) first_queued = now;
+        if (queue_tail - queue_head >= MAX_BATCH_RECORDS || now - first_queued >= REPLICATION_BATCH_DELAY) {
+            flush_queue(now);
+            first_queued = 0;
+        }
+    }
+
+    if (ack_due || now - last_sent >= REPLICATION_HEARTBEAT) {
+        struct replication_message message;
+        send_message(&message, 0, sent_seq, sent_seq, (u_int32_t) now, now);
+    }
+
+    report(now);
+}
+
+long replication_wait(long now) {
+    if (sock < 0) return -1;
+
+    long wait = last_sent + REPLICATION_HEARTBEAT - now;
+    if (queue_head != queue_tail) {
+        long batch = first_queued ? first_queued + REPLICATION_BATCH_DELAY - now : 0;
+        if (batch < wait) wait = batch;
+    }
+    if (!active) {
+        long failover = last_heard + failover_timeout + 1 - now;
+        if (failover < wait) wait = failover;
+    }
+    return wait < 0 ? 0 : wait;
+}
+
+const struct replication_stats *replication_get_stats(void) {
+    return &stats;
+}
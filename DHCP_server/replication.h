@@ -0,0 +1,57 @@
+#ifndef DHCP_SERVER_REPLICATION_H
+#define DHCP_SERVER_REPLICATION_H
+
+#include <netinet/in.h>
+
+#include "lease.h"
+
+#define REPLICATION_HEARTBEAT 100       /* milliseconds between messages when nothing changes */
+#define REPLICATION_BATCH_DELAY 5       /* milliseconds a change may wait for more to share its datagram */
+#define REPLICATION_RESEND 500          /* milliseconds without ack progress before a resync */
+#define DEFAULT_FAILOVER_TIMEOUT 1000   /* milliseconds of silence before the standby takes over */
+
+/*
+ * Active/standby lease replication over UDP. Both instances stream their
+ * local lease changes to each other in batches of fixed-size records, every
+ * datagram carries the sender's change numbers and an ack for the peer's. A
+ * resync after a partition only sends the leases changed since the last ack.
+ */
+
+struct replication_stats {
+    unsigned long records_sent;
+    unsigned long batches_sent;
+    unsigned long records_applied;
+    unsigned long resyncs;
+    unsigned long takeovers;
+    unsigned long lag_samples;
+    unsigned long lag_total;        /* milliseconds from the local change to the peer's ack */
+    unsigned long lag_max;
+    unsigned long foreign_dropped;  /* datagrams not from the peer's address and port */
+};
+
+/*
+ * Bind port on listen_ip and stream to peer, or use handed_sock when it is a
+ * socket taken over from a previous server. Returns the socket to watch,
+ * ERROR on failure.
+ */
+int replication_open(struct in_addr listen_ip, in_port_t port, struct sockaddr_in peer,
+                     int active, long failover_timeout, int handed_sock);
+
+/* Whether this instance currently answers clients. */
+int replication_is_active(void);
+
+/* Queue a locally made change of lease for the peer. */
+void replication_note(struct lease *lease);
+
+/* Read all pending datagrams from the peer. */
+void replication_receive(long now);
+
+/* Send due batches, heartbeats and resyncs, and take over if the active peer went silent. */
+void replication_run(long now);
+
+/* Milliseconds until replication_run() has something to do. */
+long replication_wait(long now);
+
+const struct replication_stats *replication_get_stats(void);
+
+#endif
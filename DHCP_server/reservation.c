@@ -0,0 +1,192 @@
+#include "reservation.h"
+
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BUCKET_SIZE 4                /* average keys per first level bucket */
+
+static int parse_mac(const char *text, unsigned char *chaddr) {
+    unsigned int bytes[RESERVATION_HLEN];
+    char tail;
+    if (sscanf(text, "%x:%x:%x:%x:%x:%x%c", &bytes[0], &bytes[1], &bytes[2],
+               &bytes[3], &bytes[4], &bytes[5], &tail) != RESERVATION_HLEN) {
+        return -1;
+    }
+    for (int i = 0; i < RESERVATION_HLEN; i++) {
+        if (bytes[i] > 0xFF) return -1;
+        chaddr[i] = (unsigned char) bytes[i];
+    }
+    return 0;
+}
+
+static struct reservation *read_entries(const char *path, u_int32_t *count) {
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        printf("Could not open reservations file %s\n", path);
+        return NULL;
+    }
+
+    u_int32_t capacity = 64;
+    struct reservation *entries = malloc(capacity * sizeof(*entries));
+    *count = 0;
+
+    char *line = NULL;
+    size_t len = 0;
+    int line_number = 0;
+    while (entries != NULL && getline(&line, &len, file) != -1) {
+        line_number++;
+        char *comment = strchr(line, '#');
+        if (comment) *comment = '\0';
+
+        char mac[32], address[32];
+        int fields = sscanf(line, "%31s %31s", mac, address);
+        if (fields <= 0) continue;
+
+        struct reservation entry;
+        if (fields != 2 || parse_mac(mac, entry.chaddr) != 0 || !inet_aton(address, &entry.address)) {
+            printf("%s:%d: invalid reservation\n", path, line_number);
+            free(entries);
+            entries = NULL;
+            break;
+        }
+        if (*count == capacity) {
+            capacity *= 2;
+            struct reservation *grown = realloc(entries, capacity * sizeof(*entries));
+            if (grown == NULL) {
+                free(entries);
+                entries = NULL;
+                break;
+            }
+            entries = grown;
+        }
+        entries[(*count)++] = entry;
+    }
+    free(line);
+    fclose(file);
+    return entries;
+}
+
+static int compare_chaddr(const void *a, const void *b) {
+    return memcmp(((const struct reservation *) a)->chaddr, ((const struct reservation *) b)->chaddr,
+                  RESERVATION_HLEN);
+}
+
+/* Place every bucket, biggest first, at a displacement where all of its keys land in free slots. */
+static int build(struct reservation_table *table, struct reservation *input) {
+    u_int32_t n = table->count, buckets = table->bucket_count;
+    u_int32_t *bucket_of = malloc(n * sizeof(*bucket_of));
+    u_int32_t *start = calloc(buckets + 1, sizeof(*start));
+    u_int32_t *members = malloc(n * sizeof(*members));
+    u_int32_t *order = malloc(buckets * sizeof(*order));
+    u_int64_t *slots = malloc(n * sizeof(*slots));
+    unsigned char *taken = calloc(n, 1);
+    int result = -1;
+    if (!bucket_of || !start || !members || !order || !slots || !taken) goto out;
+
+    u_int32_t max_size = 0;
+    for (u_int32_t i = 0; i < n; i++) {
+        bucket_of[i] = (u_int32_t) (reservation_hash(reservation_key(input[i].chaddr), 0) % buckets);
+        start[bucket_of[i] + 1]++;
+    }
+    for (u_int32_t b = 0; b < buckets; b++) {
+        if (start[b + 1] > max_size) max_size = start[b + 1];
+        start[b + 1] += start[b];
+    }
+    u_int32_t *fill = order;                         /* reused as a cursor before sorting */
+    memcpy(fill, start, buckets * sizeof(*fill));
+    for (u_int32_t i = 0; i < n; i++) members[fill[bucket_of[i]]++] = i;
+
+    /* counting sort of the buckets by size, largest first */
+    u_int32_t position = 0;
+    for (u_int32_t size = max_size; size > 0; size--) {
+        for (u_int32_t b = 0; b < buckets; b++) {
+            if (start[b + 1] - start[b] == size) order[position++] = b;
+        }
+    }
+    for (u_int32_t b = 0; b < buckets; b++) {
+        if (start[b + 1] == start[b]) {
+            order[position++] = b;
+            table->displacements[b] = 0;
+        }
+    }
+
+    u_int64_t max_tries = (u_int64_t) n * 64 + 1024;
+    for (u_int32_t o = 0; o < buckets; o++) {
+        u_int32_t b = order[o], first = start[b], size = start[b + 1] - start[b];
+        if (size == 0) break;
+
+        u_int64_t d;
+        for (d = 0; d < max_tries; d++) {
+            u_int32_t k;
+            for (k = 0; k < size; k++) {
+                u_int64_t key = reservation_key(input[members[first + k]].chaddr);
+                slots[k] = reservation_hash(key, d + 1) % n;
+                if (taken[slots[k]]) break;
+                u_int32_t j;
+                for (j = 0; j < k && slots[j] != slots[k]; j++);
+                if (j < k) break;
+            }
+            if (k == size) break;
+        }
+        if (d == max_tries) goto out;
+
+        table->displacements[b] = (u_int32_t) d;
+        for (u_int32_t k = 0; k < size; k++) {
+            taken[slots[k]] = 1;
+            table->entries[slots[k]] = input[members[first + k]];
+        }
+    }
+    result = 0;
+
+out:
+    free(bucket_of);
+    free(start);
+    free(members);
+    free(order);
+    free(slots);
+    free(taken);
+    return result;
+}
+
+struct reservation_table *reservation_load(const char *path) {
+    u_int32_t count;
+    struct reservation *input = read_entries(path, &count);
+    if (input == NULL) return NULL;
+
+    qsort(input, count, sizeof(*input), compare_chaddr);
+    for (u_int32_t i = 1; i < count; i++) {
+        if (compare_chaddr(&input[i - 1], &input[i]) == 0) {
+            printf("%s: duplicate reservation for the same hardware address\n", path);
+            free(input);
+            return NULL;
+        }
+    }
+
+    struct reservation_table *table = calloc(1, sizeof(*table));
+    if (table == NULL) {
+        free(input);
+        return NULL;
+    }
+    table->count = count;
+    table->bucket_count = count / BUCKET_SIZE + 1;
+    table->displacements = calloc(table->bucket_count, sizeof(*table->displacements));
+    table->entries = calloc(count ? count : 1, sizeof(*table->entries));
+
+    if (table->displacements == NULL || table->entries == NULL || (count && build(table, input) != 0)) {
+        printf("%s: could not build the reservation table\n", path);
+        free(input);
+        reservation_free(table);
+        return NULL;
+    }
+    free(input);
+    return table;
+}
+
+void reservation_free(struct reservation_table *table) {
+    if (table == NULL) return;
+    free(table->displacements);
+    free(table->entries);
+    free(table);
+}
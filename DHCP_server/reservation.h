@@ -0,0 +1,60 @@
+#ifndef DHCP_SERVER_RESERVATION_H
+#define DHCP_SERVER_RESERVATION_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+#define RESERVATION_HLEN 6
+
+struct reservation {
+    unsigned char chaddr[RESERVATION_HLEN];
+    struct in_addr address;
+};
+
+/*
+ * Static MAC -> address reservations compiled into a minimal perfect hash
+ * (hash and displace). A lookup reads one displacement and one entry, there
+ * are no collision chains to walk.
+ */
+struct reservation_table {
+    u_int32_t count;                 /* number of entries, also the number of slots */
+    u_int32_t bucket_count;
+    u_int32_t *displacements;        /* per bucket seed for the second level hash */
+    struct reservation *entries;     /* entry for the key that hashes to each slot */
+};
+
+/* Read "aa:bb:cc:dd:ee:ff a.b.c.d" lines from path. NULL on error. */
+struct reservation_table *reservation_load(const char *path);
+void reservation_free(struct reservation_table *table);
+
+static inline u_int64_t reservation_key(const unsigned char *chaddr) {
+    u_int64_t key = 0;
+    for (int i = 0; i < RESERVATION_HLEN; i++) key = (key << 8) | chaddr[i];
+    return key;
+}
+
+static inline u_int64_t reservation_hash(u_int64_t key, u_int64_t seed) {
+    key ^= seed * 0x9E3779B97F4A7C15ULL;
+    key ^= key >> 30;
+    key *= 0xBF58476D1CE4E5B9ULL;
+    key ^= key >> 27;
+    key *= 0x94D049BB133111EBULL;
+    key ^= key >> 31;
+    return key;
+}
+
+/* Reserved address for chaddr, or NULL if the client has no reservation. */
+static inline const struct reservation *reservation_lookup(const struct reservation_table *table,
+                                                            const unsigned char *chaddr) {
+    if (table == NULL || table->count == 0) return NULL;
+
+    u_int64_t key = reservation_key(chaddr);
+    u_int32_t bucket = (u_int32_t) (reservation_hash(key, 0) % table->bucket_count);
+    u_int32_t slot = (u_int32_t) (reservation_hash(key, (u_int64_t) table->displacements[bucket] + 1) % table->count);
+
+    const struct reservation *entry = &table->entries[slot];
+    return reservation_key(entry->chaddr) == key ? entry : NULL;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#include "ring.h"
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <linux/filter.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+static int ring_fd = -1;
+static unsigned char *ring;
+static unsigned int current_block;
+static struct tpacket3_hdr *current_frame;     /* next frame to serve in the current block */
+static unsigned int frames_left;
+
+static struct tpacket_block_desc *block(unsigned int index) {
+    return (struct tpacket_block_desc *) (ring + (size_t) index * RING_BLOCK_SIZE);
+}
+
+int ring_open(const char *interface_name, in_port_t port) {
+    /* ip and udp and not a fragment and udp dst port == port */
+    struct sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, ETH_P_IP, 0, 8),
+        BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 23),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_UDP, 0, 6),
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 20),
+        BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 0x1FFF, 4, 0),
+        BPF_STMT(BPF_LDX | BPF_B | BPF_MSH, 14),
+        BPF_STMT(BPF_LD | BPF_H | BPF_IND, 16),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, port, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0xFFFF),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    struct sock_fprog filter = {sizeof(code) / sizeof(code[0]), code};
+
+    /* ETH_P_ALL taps see frames before a bridge takes them, so bridge ports can be watched too */
+    ring_fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL));
+    if (ring_fd < 0) {
+        perror("Could not create packet ring socket");
+        return ERROR;
+    }
+    if (setsockopt(ring_fd, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0) {
+        printf("Could not attach the ring filter\n");
+        goto fail;
+    }
+
+    /* frames this host sends are never requests for it, and a monitor must not learn from them */
+    int ignore = 1;
+    setsockopt(ring_fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &ignore, sizeof(ignore));
+
+    int version = TPACKET_V3;
+    if (setsockopt(ring_fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+        printf("TPACKET_V3 is not supported\n");
+        goto fail;
+    }
+
+    struct tpacket_req3 request;
+    memset(&request, 0, sizeof(request));
+    request.tp_block_size = RING_BLOCK_SIZE;
+    request.tp_block_nr = RING_BLOCK_COUNT;
+    request.tp_frame_size = RING_FRAME_SIZE;
+    request.tp_frame_nr = RING_BLOCK_SIZE / RING_FRAME_SIZE * RING_BLOCK_COUNT;
+    request.tp_retire_blk_tov = RING_BLOCK_TIMEOUT;
+    if (setsockopt(ring_fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) < 0) {
+        printf("Could not set up the packet ring\n");
+        goto fail;
+    }
+
+    ring = mmap(NULL, (size_t) RING_BLOCK_SIZE * RING_BLOCK_COUNT, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_LOCKED, ring_fd, 0);
+    if (ring == MAP_FAILED) {
+        ring = mmap(NULL, (size_t) RING_BLOCK_SIZE * RING_BLOCK_COUNT, PROT_READ | PROT_WRITE, MAP_SHARED, ring_fd, 0);
+    }
+    if (ring == MAP_FAILED) {
+        printf("Could not map the packet ring\n");
+        goto fail;
+    }
+
+    struct ifreq interface_request;
+    memset(&interface_request, 0, sizeof(interface_request));
+    strncpy(interface_request.ifr_name, interface_name, IFNAMSIZ - 1);
+    if (ioctl(ring_fd, SIOCGIFINDEX, &interface_request) < 0) {
+        printf("Could not find interface %s for the packet ring\n", interface_name);
+        goto fail;
+    }
+
+    struct sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_ALL);
+    address.sll_ifindex = interface_request.ifr_ifindex;
+    if (bind(ring_fd, (struct sockaddr *) &address, sizeof(address)) < 0) {
+        printf("Could not bind the packet ring to %s\n", interface_name);
+        goto fail;
+    }
+
+    printf("Receiving through a TPACKET_V3 ring of %d x %d KB blocks\n", RING_BLOCK_COUNT, RING_BLOCK_SIZE / 1024);
+    return ring_fd;
+
+fail:
+    close(ring_fd);
+    return ring_fd = ERROR;
+}
+
+int ring_mute_socket(int sock) {
+    struct sock_filter code[] = {BPF_STMT(BPF_RET | BPF_K, 0)};
+    struct sock_fprog filter = {1, code};
+    return setsockopt(sock, SOL_SOCKET, SO_ATTACH_FILTER, &filter, sizeof(filter)) < 0 ? ERROR : OK;
+}
+
+int ring_unmute_socket(int sock) {
+    int unused = 0;
+    if (setsockopt(sock, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) == 0) return OK;
+    return errno == ENOENT ? OK : ERROR;
+}
+
+/* Extract the UDP payload of one frame. ERROR if it is not a usable request. */
+static int read_frame(struct tpacket3_hdr *frame, void *buffer, size_t buffer_size, struct sockaddr_in *source) {
+    unsigned char *data = (unsigned char *) frame + frame->tp_net;
+    size_t length = frame->tp_snaplen - (frame->tp_net - frame->tp_mac);
+
+    if (length < sizeof(struct iphdr)) return ERROR;
+    struct iphdr *ip = (struct iphdr *) data;
+    size_t ip_length = ip->ihl * 4;
+    if (ip_length < sizeof(struct iphdr) || length < ip_length + sizeof(struct udphdr)) return ERROR;
+    struct udphdr *udp = (struct udphdr *) (data + ip_length);
+
+    size_t payload = length - ip_length - sizeof(struct udphdr);
+    size_t udp_payload = ntohs(udp->len) >= sizeof(struct udphdr) ? ntohs(udp->len) - sizeof(struct udphdr) : 0;
+    if (udp_payload < payload) payload = udp_payload;
+    if (payload > buffer_size) payload = buffer_size;
+
+    memcpy(buffer, data + ip_length + sizeof(struct udphdr), payload);
+    memset((char *) buffer + payload, 0, buffer_size - payload);
+
+    memset(source, 0, sizeof(*source));
+    source->sin_family = AF_INET;
+    source->sin_port = udp->source;
+    source->sin_addr.s_addr = ip->saddr;
+    return OK;
+}
+
+int ring_next(void *buffer, size_t buffer_size, struct sockaddr_in *source, struct timespec *received) {
+    while (1) {
+        if (frames_left == 0) {
+            struct tpacket_block_desc *descriptor = block(current_block);
+            if (current_frame != NULL) {
+                /* every frame of this block is served, give it back and move on */
+                __atomic_store_n(&descriptor->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                current_block = (current_block + 1) % RING_BLOCK_COUNT;
+                current_frame = NULL;
+                descriptor = block(current_block);
+            }
+            if (!(__atomic_load_n(&descriptor->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER)) {
+                return ERROR;
+            }
+            frames_left = descriptor->hdr.bh1.num_pkts;
+            current_frame = (struct tpacket3_hdr *) ((unsigned char *) descriptor +
+                                                     descriptor->hdr.bh1.offset_to_first_pkt);
+            if (frames_left == 0) continue;
+        }
+
+        struct tpacket3_hdr *frame = current_frame;
+        frames_left--;
+        current_frame = (struct tpacket3_hdr *) ((unsigned char *) frame + frame->tp_next_offset);
+
+        if (read_frame(frame, buffer, buffer_size, source) == OK) {
+            received->tv_sec = frame->tp_sec;
+            received->tv_nsec = frame->tp_nsec;
+            return OK;
+        }
+    }
+}
@@ -0,0 +1,37 @@
+#ifndef DHCP_SERVER_RING_H
+#define DHCP_SERVER_RING_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <time.h>
+
+#define RING_BLOCK_SIZE  (1 << 16)
+#define RING_BLOCK_COUNT 64
+#define RING_FRAME_SIZE  2048
+#define RING_BLOCK_TIMEOUT 1         /* milliseconds before the kernel hands over a partly filled block */
+
+/*
+ * Optional receive path: an AF_PACKET socket with a memory-mapped TPACKET_V3
+ * ring and a BPF filter that only lets UDP to the server port through. The
+ * kernel fills whole blocks of frames; ring_next() walks them in place and
+ * only returns a block when all of its frames have been served, so there is no
+ * syscall per packet. Replies still leave through the UDP socket.
+ */
+
+/* Map the ring on interface_name for UDP destination port. Returns the fd to poll, ERROR on failure. */
+int ring_open(const char *interface_name, in_port_t port);
+
+/*
+ * Copy the next request into buffer (the tail is zeroed) and fill in its
+ * source and kernel receive time. OK if there was one, ERROR once the ring is
+ * empty and the fd has to be polled.
+ */
+int ring_next(void *buffer, size_t buffer_size, struct sockaddr_in *source, struct timespec *received);
+
+/* Attach a filter that drops everything, for the UDP socket the ring replaces on receive. */
+int ring_mute_socket(int sock);
+
+/* Take that filter off again, for a socket handed over by a server that read through a ring. OK if there was none. */
+int ring_unmute_socket(int sock);
+
+#endif
@@ -1,2 +1,2 @@
-gcc -o server server.c
-sudo ./server
+gcc -o server server.c config.c reservation.c arp_probe.c lease.c replication.c query.c messages.c metrics.c ring.c unicast.c xdp_filter.c bpf_asm.c flood.c quota.c handoff.c -lpthread -lm
+sudo ./server server.conf
@@ -1,7 +1,11 @@
+#define _GNU_SOURCE
 #include <arpa/inet.h>
+#include <errno.h>
 #include <locale.h>
 #include <net/if.h>
 #include <netinet/in.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -12,67 +16,98 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../common/dhcp.h"
+#include "arp_probe.h"
+#include "config.h"
+#include "flood.h"
+#include "handoff.h"
+#include "lease.h"
+#include "messages.h"
+#include "metrics.h"
+#include "probes.h"
+#include "query.h"
+#include "quota.h"
+#include "replication.h"
+#include "ring.h"
+#include "unicast.h"
+#include "xdp_filter.h"
+
 #define OK 0
 #define ERROR -1
-
-#define MAX_CHADDR_LENGTH  16
-#define MAX_SNAME_LENGTH   64
-#define MAX_FILE_LENGTH    128
-#define MAX_OPTIONS_LENGTH 312
-
-struct DHCP_packet {
-    u_int8_t op;                             /* packet type */
-    u_int8_t htype;                          /* type of hardware address for this machine (Ethernet, etc) */
-    u_int8_t hlen;                           /* length of hardware address (of this machine) */
-    u_int8_t hops;                           /* hops */
-    u_int32_t xid;                           /* random transaction id number - chosen by this machine */
-    u_int16_t secs;                          /* seconds used in timing */
-    u_int16_t flags;                         /* flags */
-    struct in_addr ciaddr;                   /* IP address of this machine (if we already have one) */
-    struct in_addr yiaddr;                   /* IP address of this machine (offered by the DHCP server) */
-    struct in_addr siaddr;                   /* IP address of DHCP server */
-    struct in_addr giaddr;                   /* IP address of DHCP relay */
-    unsigned char chaddr[MAX_CHADDR_LENGTH]; /* hardware address of this machine */
-    char sname[MAX_SNAME_LENGTH];            /* name of DHCP server */
-    char file[MAX_FILE_LENGTH];              /* boot file name (used for disk-less booting?) */
-    char options[MAX_OPTIONS_LENGTH];        /* options */
-};
-typedef struct DHCP_packet DHCP_packet;
-
-#define DHCP_DISCOVER 1
-#define DHCP_OFFER    2
-#define DHCP_REQUEST  3
-#define DHCP_ACK      5
-#define DHCP_NACK     6
-
-#define BROADCAST_FLAG 0x8000
+#define NO_PACKET 1
+#define HANDED_OFF 2
 
 #define SERVER_PORT 66
-#define CLIENT_PORT 68
 
-#define HTYPE 1
-#define HLEN  6
-
-#define OPTION_ADDRESS_REQUEST 50
-#define OPTION_LEASE_TIME 51
-#define OPTION_MESSAGE_TYPE    53
-
-#define OPTION_SERVER_ID       54
-#define OPTION_DEFAULT_GATEWAY_ROUTER_ID 3
-#define OPTION_DNS_SERVER_ID 6
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69          /* Linux 5.11 */
+#endif
+
+#define MAX_PENDING_OFFERS 32
+#define PENDING_OFFER_TIMEOUT 2000      /* milliseconds, the client has retransmitted by then */
+#define MAX_OPEN_OFFERS 256             /* fresh pool addresses remembered per client until it chooses */
+#define OPEN_OFFER_HOLD 60              /* seconds an unanswered offer keeps its address from the reclaim walk */
+#define RECLAIM_RETRY 1                 /* seconds before walking the lease table again after a walk found nothing */
+
+/* option layout of OFFER and ACK */
+enum reply_layout {
+    REPLY_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    REPLY_ROUTER = REPLY_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    REPLY_SERVER_ID = REPLY_ROUTER + DHCP_OPTION_SIZE(4),
+    REPLY_DNS = REPLY_SERVER_ID + DHCP_OPTION_SIZE(4),
+    REPLY_LEASE_TIME = REPLY_DNS + DHCP_OPTION_SIZE(4),
+    REPLY_END = REPLY_LEASE_TIME + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(REPLY_END + DHCP_OPTION_SIZE(255) + 1);     /* room to echo option 82 */
 
-#define START_IP 120
-#define END_IP 150
+/* option layout of NAK */
+enum nak_layout {
+    NAK_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    NAK_SERVER_ID = NAK_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    NAK_END = NAK_SERVER_ID + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(NAK_END + DHCP_OPTION_SIZE(255) + 1);
 
 struct ifreq interface;
 struct in_addr server_ip;
-int offer_count = START_IP;
+u_int32_t next_offer = 0;     /* host byte order, next pool address to hand out */
 int normal;
+int arp_sock = -1;
+int replication_sock = -1;
+int ring_sock = -1;
+int handoff_listener = -1;
+int handoff_sock = -1;                  /* the listener, or the connection to a successor getting ready */
+int handoff_fds[HANDOFF_FD_COUNT];      /* what a successor takes over */
+struct timespec packet_received;        /* kernel receive time of the request being answered */
+struct timespec last_served;            /* receive time of the last request read, or answered by the predecessor */
+
+DHCP_packet pending_offers[MAX_PENDING_OFFERS];   /* DISCOVERs waiting for a probed address */
+long pending_since[MAX_PENDING_OFFERS];
+struct timespec pending_received[MAX_PENDING_OFFERS];
+int pending_count = 0;
+
+struct open_offer {
+    unsigned char chaddr[LEASE_HLEN];
+    struct in_addr addr;                /* 0 once withdrawn or taken */
+    time_t made;
+};
+struct open_offer open_offers[MAX_OPEN_OFFERS];   /* oldest overwritten first */
+int open_offer_next = 0;
+u_int32_t returned_addresses[MAX_OPEN_OFFERS];    /* host byte order, offers another server won, handed out first */
+int returned_count = 0;
+u_int32_t reclaim_cursor = 0;           /* where the next walk for expired leases starts */
+time_t reclaim_idle_until = 0;
 
 unsigned char random_mac[MAX_CHADDR_LENGTH];
 u_int32_t transaction_id = 0;
 struct in_addr offered_address;
 
+long now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
+
 struct sockaddr_in get_address(in_port_t port, in_addr_t ip) {
     struct sockaddr_in address;
     address.sin_family = AF_INET;
@@ -106,6 +141,11 @@ int create_DHCP_socket(char *interface_name) {
         printf("\tCould not bind socket to interface %s. Check your privileges...\n", interface_name);
         exit(EXIT_FAILURE);
     }
+    opt_val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS, &opt_val, sizeof opt_val) < 0) {
+        printf(" Could not set timestamp option on DHCP socket!\n");
+        exit(EXIT_FAILURE);
+    }
     struct sockaddr_in client_address = get_address(SERVER_PORT, INADDR_ANY);
     if (bind(sock, (struct sockaddr *) &client_address, sizeof(client_address)) < 0) {
         printf("\tCould not bind to DHCP socket (port %d)! Check your privileges...\n", SERVER_PORT);
@@ -148,6 +188,33 @@ int create_normal_socket(char *interface_name) {
     return sock;
 }
 
+/* Let receive calls poll the device queue for up to micros instead of waiting for an interrupt. */
+void enable_busy_poll(int sock, int micros) {
+    int opt_val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_BUSY_POLL, &micros, sizeof(micros)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_PREFER_BUSY_POLL, &opt_val, sizeof(opt_val)) < 0) {
+        printf(" Could not enable busy polling on the receive socket!\n");
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Keep the packet loop on one core, so its cache and the spinning stay there. Other threads keep every core. */
+void pin_packet_thread(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0) {
+        printf("Could not pin the packet thread to CPU %d\n", cpu);
+        exit(EXIT_FAILURE);
+    }
+}
+
+long elapsed_us(const struct timespec *since) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - since->tv_sec) * 1000000L + (now.tv_nsec - since->tv_nsec) / 1000;
+}
+
 int send_packet(void *buffer, int buffer_size, int sock, struct sockaddr_in *dest) {
     int result = (int) sendto(sock, buffer, buffer_size, 0, (struct sockaddr *) dest, sizeof(*dest));
 
@@ -157,172 +224,685 @@ int send_packet(void *buffer, int buffer_size, int sock, struct sockaddr_in *des
     return OK;
 }
 
-int receive_packet(void *buffer, size_t buffer_size, int sock, struct sockaddr_in *source_address) {
+/* Read one request from the UDP socket with its kernel receive time, NO_PACKET if MSG_DONTWAIT found none. */
+int read_request(void *buffer, size_t buffer_size, int sock, struct sockaddr_in *source_address, int flags) {
+    memset(source_address, 0, sizeof(*source_address));
+
+    struct iovec vector = {buffer, buffer_size};
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct msghdr header;
+    memset(&header, 0, sizeof(header));
+    header.msg_name = source_address;
+    header.msg_namelen = sizeof(*source_address);
+    header.msg_iov = &vector;
+    header.msg_iovlen = 1;
+    header.msg_control = control;
+    header.msg_controllen = sizeof(control);
+    int received_data = (int) recvmsg(sock, &header, flags);
+    if (received_data == -1) return errno == EAGAIN || errno == EINTR ? NO_PACKET : ERROR;
+    memset((char *) buffer + received_data, 0, buffer_size - received_data);
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&header);
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+        memcpy(&packet_received, CMSG_DATA(cmsg), sizeof(packet_received));
+    }
+    else {
+        clock_gettime(CLOCK_REALTIME, &packet_received);
+    }
+    return OK;
+}
+
+/*
+ * Low-latency mode: look for the next request without sleeping for up to
+ * spin_time microseconds, so a request arriving soon after the last one costs
+ * no wakeup. With busy polling on, each read also polls the device queue.
+ */
+int spin_for_packet(void *buffer, size_t buffer_size, int sock, struct sockaddr_in *source_address, long spin_time) {
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    do {
+        if (ring_sock >= 0) {
+            if (ring_next(buffer, buffer_size, source_address, &packet_received) == OK) return OK;
+        }
+        else {
+            int result = read_request(buffer, buffer_size, sock, source_address, MSG_DONTWAIT);
+            if (result != NO_PACKET) return result;
+        }
+    } while (elapsed_us(&start) < spin_time);
+    return NO_PACKET;
+}
+
+int receive_packet(void *buffer, size_t buffer_size, int sock, struct sockaddr_in *source_address, long timeout) {
+    /* frames already in the ring are served without a syscall */
+    if (ring_sock >= 0 && ring_next(buffer, buffer_size, source_address, &packet_received) == OK) return OK;
+
+    /* due probes and replication timers come first, spinning would only delay them */
+    long spin_time = config_get()->spin_time;
+    if (spin_time && timeout != 0) {
+        int result = spin_for_packet(buffer, buffer_size, sock, source_address, spin_time);
+        if (result != NO_PACKET) return result;
+        if (timeout > 0) timeout = timeout > spin_time / 1000 ? timeout - spin_time / 1000 : 0;
+    }
+
+    int receive_fd = ring_sock >= 0 ? ring_sock : sock;
     fd_set read_fds;
     FD_ZERO(&read_fds);
-    FD_SET(sock, &read_fds);
-    FD_SET(normal, &read_fds);
-
-    select((sock > normal ? sock : normal) + 1, &read_fds, NULL, NULL, NULL);
-
-    if (FD_ISSET(normal, &read_fds)) {
-        socklen_t address_size = sizeof(*source_address);
-        memset(source_address, 0, address_size);
-        memset(buffer, 0, sizeof(*buffer));
-        int received_data =
-                (int) recvfrom(normal, buffer, 100, 0, (struct sockaddr *) source_address, &address_size);
-        if (received_data == -1) return ERROR;
-        printf("Message from client: %s", (char *)buffer);
-        fflush(stdout);
-        return OK;
+    FD_SET(receive_fd, &read_fds);
+    int max_fd = receive_fd;
+    if (arp_sock >= 0) {
+        FD_SET(arp_sock, &read_fds);
+        if (arp_sock > max_fd) max_fd = arp_sock;
+    }
+    if (replication_sock >= 0) {
+        FD_SET(replication_sock, &read_fds);
+        if (replication_sock > max_fd) max_fd = replication_sock;
+    }
+    if (handoff_sock >= 0) {
+        FD_SET(handoff_sock, &read_fds);
+        if (handoff_sock > max_fd) max_fd = handoff_sock;
+    }
+
+    struct timeval time_val;
+    time_val.tv_sec = timeout / 1000;
+    time_val.tv_usec = (timeout % 1000) * 1000;
+
+    config_offline();
+    int ready = select(max_fd + 1, &read_fds, NULL, NULL, timeout < 0 ? NULL : &time_val);
+    config_online();
+
+    if (ready < 0) return errno == EINTR ? NO_PACKET : ERROR;
+    if (ready == 0) return NO_PACKET;
+
+    if (arp_sock >= 0 && FD_ISSET(arp_sock, &read_fds)) {
+        arp_probe_receive(now_ms(), config_get()->arp_probe_ttl);
+    }
+    if (replication_sock >= 0 && FD_ISSET(replication_sock, &read_fds)) {
+        replication_receive(now_ms());
+    }
+    if (handoff_sock >= 0 && FD_ISSET(handoff_sock, &read_fds)) {
+        if (handoff_sock == handoff_listener) {
+            int successor = handoff_accept(handoff_fds);
+            if (successor >= 0) handoff_sock = successor;
+        }
+        /* frames only our ring holds go out first, the successor skips up to the last one served */
+        else if (ring_sock < 0 || !FD_ISSET(ring_sock, &read_fds)) {
+            if (handoff_finish(&last_served) == OK) return HANDED_OFF;
+            handoff_sock = handoff_listener;
+        }
     }
-    else if (FD_ISSET(sock, &read_fds)) {
-        socklen_t address_size = sizeof(*source_address);
-        memset(source_address, 0, address_size);
-        memset(buffer, 0, sizeof(*buffer));
-        int received_data =
-                (int) recvfrom(sock, buffer, buffer_size, 0, (struct sockaddr *) source_address, &address_size);
 
-        return (received_data == -1) ? ERROR : OK;
+    if (ring_sock >= 0) {
+        if (!FD_ISSET(ring_sock, &read_fds)) return NO_PACKET;
+        return ring_next(buffer, buffer_size, source_address, &packet_received) == OK ? OK : NO_PACKET;
+    }
+    else if (FD_ISSET(sock, &read_fds)) {
+        return read_request(buffer, buffer_size, sock, source_address, 0);
     }
     else {
-        return ERROR;
+        return NO_PACKET;
+    }
+}
+
+int probing(const struct server_config *config) {
+    return arp_sock >= 0 && config->arp_probe;
+}
+
+/* Whether addr was offered to a client lately that has not chosen yet. */
+int offer_open(struct in_addr addr, time_t now) {
+    for (int i = 0; i < MAX_OPEN_OFFERS; i++) {
+        if (open_offers[i].addr.s_addr == addr.s_addr && now - open_offers[i].made < OPEN_OFFER_HOLD) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Once every pool address has been handed out, take back one whose lease has
+ * expired or was released: walk the lease table from where the last walk
+ * stopped for a record whose address nobody holds or has been offered since.
+ * A walk that finds nothing looks at every record once, so the next waits
+ * RECLAIM_RETRY seconds.
+ */
+int reclaim_pool_address(const struct server_config *config, struct in_addr *addr) {
+    time_t now = time(NULL);
+    if (now < reclaim_idle_until) return ERROR;
+    u_int32_t total = lease_count();
+    for (u_int32_t i = 0; i < total; i++) {
+        const struct lease *lease = lease_next(&reclaim_cursor);
+        if (lease == NULL) {
+            reclaim_cursor = 0;
+            lease = lease_next(&reclaim_cursor);
+        }
+        u_int32_t host = ntohl(lease->addr.s_addr);
+        struct lease_info holder;
+        if (lease->expiry > (u_int32_t) now || host < ntohl(config->start_ip.s_addr) ||
+            host > ntohl(config->end_ip.s_addr) || config_is_reserved(config, host) ||
+            (lease_query_address(lease->addr, &holder) == OK && holder.expiry > (u_int32_t) now) ||
+            offer_open(lease->addr, now)) {
+            continue;
+        }
+        *addr = lease->addr;
+        return OK;
+    }
+    reclaim_idle_until = now + RECLAIM_RETRY;
+    return ERROR;
+}
+
+int next_pool_address(const struct server_config *config, struct in_addr *addr) {
+    /* offers another server won, and addresses whose lease record went to a new client */
+    while (returned_count > 0 || lease_take_freed(addr) == OK) {
+        u_int32_t back = returned_count > 0 ? returned_addresses[--returned_count] : ntohl(addr->s_addr);
+        struct lease_info holder;
+        addr->s_addr = htonl(back);
+        if (back < ntohl(config->start_ip.s_addr) || back > ntohl(config->end_ip.s_addr) ||
+            config_is_reserved(config, back) ||
+            (lease_query_address(*addr, &holder) == OK && holder.expiry > time(NULL))) {
+            continue;
+        }
+        return OK;
+    }
+
+    if (next_offer < ntohl(config->start_ip.s_addr)) next_offer = ntohl(config->start_ip.s_addr);
+    if (next_offer <= lease_highest_address()) next_offer = lease_highest_address() + 1;
+    while (next_offer <= ntohl(config->end_ip.s_addr) && config_is_reserved(config, next_offer)) next_offer++;
+    if (next_offer > ntohl(config->end_ip.s_addr)) return reclaim_pool_address(config, addr);
+
+    addr->s_addr = htonl(next_offer);
+    next_offer++;
+    return OK;
+}
+
+/* Whether a client other than chaddr holds an unexpired lease on addr, after a failover or a merge for instance. */
+int held_by_other(struct in_addr addr, const unsigned char *chaddr) {
+    struct lease_info holder;
+    return lease_query_address(addr, &holder) == OK && holder.expiry > time(NULL) &&
+           memcmp(holder.chaddr, chaddr, LEASE_HLEN) != 0;
+}
+
+struct open_offer *find_open_offer(const unsigned char *chaddr) {
+    for (int i = 0; i < MAX_OPEN_OFFERS; i++) {
+        if (open_offers[i].addr.s_addr && memcmp(open_offers[i].chaddr, chaddr, LEASE_HLEN) == 0) {
+            return &open_offers[i];
+        }
+    }
+    return NULL;
+}
+
+int make_offer_ip(const struct server_config *config, unsigned char *chaddr, struct in_addr *addr) {
+    const struct reservation *reserved = reservation_lookup(config->reservations, chaddr);
+    if (reserved) {
+        *addr = reserved->address;
+        return OK;
+    }
+
+    /* a returning client gets its old address back, unless someone else holds it by now */
+    const struct lease *lease = lease_find(chaddr);
+    if (lease && !held_by_other(lease->addr, chaddr)) {
+        *addr = lease->addr;
+        return OK;
+    }
+
+    /* a retransmitted DISCOVER gets the address offered before */
+    struct open_offer *offer = find_open_offer(chaddr);
+    if (offer && !held_by_other(offer->addr, chaddr)) {
+        *addr = offer->addr;
+        return OK;
+    }
+    if (offer) offer->addr.s_addr = 0;
+
+    int result = probing(config) ? arp_probe_take(addr, now_ms()) : next_pool_address(config, addr);
+    if (result == OK) {
+        offer = &open_offers[open_offer_next];
+        open_offer_next = (open_offer_next + 1) % MAX_OPEN_OFFERS;
+        memcpy(offer->chaddr, chaddr, LEASE_HLEN);
+        offer->addr = *addr;
+        offer->made = time(NULL);
+    }
+    return result;
+}
+
+/*
+ * RFC 2131 4.3.2: the client chose another server. Forget the DISCOVERs it
+ * has waiting for a probe and put the address offered to it back in the pool,
+ * unless it has been leased since.
+ */
+void withdraw_offer(const unsigned char *chaddr) {
+    int kept = 0;
+    for (int i = 0; i < pending_count; i++) {
+        if (memcmp(pending_offers[i].chaddr, chaddr, LEASE_HLEN) == 0) continue;
+        pending_offers[kept] = pending_offers[i];
+        pending_since[kept] = pending_since[i];
+        pending_received[kept] = pending_received[i];
+        kept++;
+    }
+    pending_count = kept;
+
+    struct open_offer *offer = find_open_offer(chaddr);
+    if (offer == NULL) return;
+    struct lease_info holder;
+    if ((lease_query_address(offer->addr, &holder) != OK || holder.expiry <= time(NULL)) &&
+        returned_count < MAX_OPEN_OFFERS) {
+        returned_addresses[returned_count++] = ntohl(offer->addr.s_addr);
     }
+    offer->addr.s_addr = 0;
 }
 
-void set_magic_cookie(DHCP_packet *packet) {
-    packet->options[0] = '\x63';
-    packet->options[1] = '\x82';
-    packet->options[2] = '\x53';
-    packet->options[3] = '\x63';
+/*
+ * RFC 2131 4.3.2: whether chaddr may be granted addr. A client with a
+ * reservation gets only that address, any other client only a pool address
+ * that is not reserved for a static host and is not the server's own.
+ */
+int address_allowed(const struct server_config *config, const unsigned char *chaddr, struct in_addr addr) {
+    const struct reservation *reserved = reservation_lookup(config->reservations, chaddr);
+    if (reserved) return reserved->address.s_addr == addr.s_addr;
+
+    u_int32_t host = ntohl(addr.s_addr);
+    if (host < ntohl(config->start_ip.s_addr) || host > ntohl(config->end_ip.s_addr)) return 0;
+    if (config_is_reserved(config, host)) return 0;
+    return addr.s_addr != server_ip.s_addr && addr.s_addr != config->router.s_addr &&
+           addr.s_addr != config->dns.s_addr;
 }
 
-void set_server_ip(DHCP_packet *packet, int pos) {
-    uint32_t ip = server_ip.s_addr;
-    packet->options[pos] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 1] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 2] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 3] = (char) (ip & 0x000000FF);
+/* Park a DISCOVER until a probe finds a free address, the packet loop keeps serving meanwhile. */
+void defer_offer(DHCP_packet *packet) {
+    if (pending_count == MAX_PENDING_OFFERS) return;
+    if (&pending_offers[pending_count] != packet) pending_offers[pending_count] = *packet;
+    pending_since[pending_count] = now_ms();
+    pending_received[pending_count] = packet_received;
+    pending_count++;
 }
 
-struct in_addr make_offer_ip() {
-    struct in_addr addr = server_ip;
-    addr.s_addr &= 0x00FFFFFF;
-    addr.s_addr |= (offer_count << 24);
-    offer_count++;
-    return addr;
+/*
+ * RFC 2131 4.1: replies go to the relay when there is one, to ciaddr when the
+ * client already holds its address, and by broadcast when the client asks for
+ * it or there is no address to send to (a NAK). A renewing client that has not
+ * configured its address yet sets the broadcast flag, since nothing would
+ * answer ARP for ciaddr. Otherwise the reply is unicast straight to chaddr at
+ * the link layer, so other hosts on the segment never see it.
+ */
+void deliver_reply(int sock, DHCP_packet *packet, int length, int renewing) {
+    struct sockaddr_in destination;
+    enum metric_delivery delivery;
+    if (packet->giaddr.s_addr) {
+        destination = get_address(SERVER_PORT, packet->giaddr.s_addr);
+        delivery = DELIVERY_RELAY;
+    }
+    else if (renewing && !(ntohs(packet->flags) & BROADCAST_FLAG)) {
+        destination = get_address(CLIENT_PORT, packet->ciaddr.s_addr);
+        delivery = DELIVERY_UNICAST;
+    }
+    else if (!(ntohs(packet->flags) & BROADCAST_FLAG) && packet->hlen == HLEN && packet->yiaddr.s_addr &&
+             unicast_send(packet, length, server_ip, SERVER_PORT, packet->yiaddr, CLIENT_PORT,
+                          packet->chaddr) == OK) {
+        delivery = DELIVERY_LINK;
+    }
+    else {
+        destination = get_address(CLIENT_PORT, INADDR_BROADCAST);
+        delivery = DELIVERY_BROADCAST;
+    }
+
+    while (delivery != DELIVERY_LINK && send_packet(packet, length, sock, &destination) == ERROR) {
+        printf("Error in sending packet... resending the packet\n");
+    }
+    metrics_count_delivery(delivery);
+    DHCP_PROBE4(reply_sent, ntohl(packet->xid), packet->chaddr, delivery, PROBE_NS(packet_received));
 }
 
-int send_DHCP_reply_packet(int sock, DHCP_packet *packet, char type) {
-    packet->op = 2;
+int send_DHCP_reply_packet(int sock, DHCP_packet *packet, char type, const struct server_config *config) {
+    packet->op = BOOT_REPLY;
+    int renewing = 0;
+
+    /* RFC 3046: option 82 goes back to the relay as it came, copy it before the options are rewritten */
+    unsigned char relay_agent[255];
+    const unsigned char *relay_option = dhcp_find_option(packet, OPTION_RELAY_AGENT);
+    int relay_length = relay_option ? relay_option[1] : -1;
+    if (relay_option) memcpy(relay_agent, relay_option + 2, relay_length);
+
+    int circuit = quota_circuit(packet);
+    if (!quota_allows(circuit, lease_find(packet->chaddr), config->circuit_quota)) {
+        printf("Circuit quota of %d addresses reached\n", config->circuit_quota);
+        DHCP_PROBE4(address_denied, ntohl(packet->xid), packet->chaddr, DENIED_QUOTA, PROBE_NS(packet_received));
+        fflush(stdout);
+        return OK;
+    }
 
     if (type == DHCP_OFFER) {
         packet->ciaddr.s_addr = 0;
-        packet->giaddr.s_addr = 0;
-        packet->yiaddr = make_offer_ip();
+        if (make_offer_ip(config, packet->chaddr, &packet->yiaddr) == ERROR) {
+            DHCP_PROBE4(address_denied, ntohl(packet->xid), packet->chaddr, DENIED_POOL_EMPTY,
+                        PROBE_NS(packet_received));
+            if (probing(config)) defer_offer(packet);
+            return OK;
+        }
         packet->siaddr = server_ip;
         printf("Offering IP: %s\n", inet_ntoa(packet->yiaddr));
+        DHCP_PROBE4(address_allocated, ntohl(packet->xid), packet->chaddr, packet->yiaddr.s_addr,
+                    PROBE_NS(packet_received));
     }
     else if (type == DHCP_ACK) {
-        packet->yiaddr = packet->ciaddr;
-        packet->ciaddr.s_addr = 0;
-        packet->giaddr.s_addr = 0;
+        /* a client selecting an offer names it in option 50, a renewing one only in ciaddr */
+        if (dhcp_get_address(packet, OPTION_ADDRESS_REQUEST, &packet->yiaddr) == ERROR) {
+            packet->yiaddr = packet->ciaddr;
+            renewing = packet->ciaddr.s_addr != 0;
+        }
+
+        /* a rebooting client may ask for an address from another network or one gone to someone else */
+        int denial = -1;
+        if (packet->yiaddr.s_addr == 0 || !address_allowed(config, packet->chaddr, packet->yiaddr)) {
+            denial = DENIED_WRONG_ADDRESS;
+        }
+        else if (held_by_other(packet->yiaddr, packet->chaddr)) {
+            denial = DENIED_IN_USE;
+        }
+        if (denial >= 0) {
+            printf("Refuse IP: %s\n", inet_ntoa(packet->yiaddr));
+            DHCP_PROBE4(address_denied, ntohl(packet->xid), packet->chaddr, denial, PROBE_NS(packet_received));
+            type = DHCP_NACK;
+            renewing = 0;
+            packet->yiaddr.s_addr = 0;
+            packet->siaddr.s_addr = 0;
+        }
+    }
+    if (type == DHCP_ACK) {
+        /* an ACK nobody recorded would let the address go to the next client, so the client hears nothing */
+        struct lease *lease = lease_update(packet->chaddr, packet->yiaddr, time(NULL) + config->lease_time);
+        if (lease == NULL) {
+            printf("Lease table full, not granting %s\n", inet_ntoa(packet->yiaddr));
+            DHCP_PROBE4(address_denied, ntohl(packet->xid), packet->chaddr, DENIED_TABLE_FULL,
+                        PROBE_NS(packet_received));
+            fflush(stdout);
+            return OK;
+        }
+        /* the lease speaks for the address from now on */
+        struct open_offer *offer = find_open_offer(packet->chaddr);
+        if (offer) offer->addr.s_addr = 0;
+        quota_assign(lease, circuit);
+        replication_note(lease);
+
         packet->siaddr = server_ip;
         printf("Grant IP: %s\n", inet_ntoa(packet->yiaddr));
+        DHCP_PROBE4(address_allocated, ntohl(packet->xid), packet->chaddr, packet->yiaddr.s_addr,
+                    PROBE_NS(packet_received));
     }
 
-    bzero(packet->options, sizeof(packet->options));
     set_magic_cookie(packet);
+    dhcp_put_u8(packet, REPLY_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, type);
+    int end = REPLY_END;
+    if (type == DHCP_NACK) {
+        dhcp_put_address(packet, NAK_SERVER_ID, OPTION_SERVER_ID, server_ip);
+        end = NAK_END;
+    }
+    else {
+        dhcp_put_address(packet, REPLY_ROUTER, OPTION_DEFAULT_GATEWAY_ROUTER_ID, config->router);
+        dhcp_put_address(packet, REPLY_SERVER_ID, OPTION_SERVER_ID, server_ip);
+        dhcp_put_address(packet, REPLY_DNS, OPTION_DNS_SERVER_ID, config->dns);
+        dhcp_put_u32(packet, REPLY_LEASE_TIME, OPTION_LEASE_TIME, config->lease_time);
+    }
+    if (relay_length >= 0) {
+        dhcp_put_bytes(packet, end, OPTION_RELAY_AGENT, relay_agent, (u_int8_t) relay_length);
+        end += DHCP_OPTION_SIZE(relay_length);
+    }
+    int length = (int) dhcp_finish(packet, end);
+    DHCP_PROBE5(reply_built, ntohl(packet->xid), packet->chaddr, type, length, PROBE_NS(packet_received));
 
-    packet->options[4] = OPTION_MESSAGE_TYPE; // message type
-    packet->options[5] = 1;
-    packet->options[6] = type;
-
-    packet->options[7] = OPTION_DEFAULT_GATEWAY_ROUTER_ID; // default gateway router IP
-    packet->options[8] = 4;
-    set_server_ip(packet, 9);
-
-    packet->options[13] = OPTION_LEASE_TIME; // lease time
-    packet->options[14] = 4;
-    char lease[4] = {120, 0, 0, 0};
-    memcpy(packet->options + 15, lease, 4); // time = 120 seconds
+    deliver_reply(sock, packet, length, renewing);
+    metrics_record_latency(CHANNEL_DHCP, &packet_received);
 
-    packet->options[13] = OPTION_SERVER_ID; // DHCP server IP
-    packet->options[14] = 4;
-    set_server_ip(packet, 15);
+    fflush(stdout);
+    return OK;
+}
 
-    packet->options[19] = OPTION_DNS_SERVER_ID; // DNS server IP
-    packet->options[20] = 4;
-    set_server_ip(packet, 21);
+void serve_pending_offers(int sock, const struct server_config *config) {
+    long now = now_ms();
+    int count = pending_count;
+    pending_count = 0;
+    for (int i = 0; i < count; i++) {
+        if (now - pending_since[i] > PENDING_OFFER_TIMEOUT) continue;
+        long since = pending_since[i];
+        int slot = pending_count;
+        packet_received = pending_received[i];
+        send_DHCP_reply_packet(sock, &pending_offers[i], DHCP_OFFER, config);
+        if (pending_count > slot) pending_since[slot] = since;
+    }
+}
 
-    packet->options[25] = '\xFF';
+/* Finish timed out probes, answer the DISCOVERs waiting for them and keep the warm pool topped up. */
+void run_probes(int sock, const struct server_config *config) {
+    long now = now_ms();
+    arp_probe_expire(now, config->arp_probe_timeout, config->arp_probe_ttl);
+    if (pending_count > 0) serve_pending_offers(sock, config);
+
+    /* bounded, a reclaimed address may already be probed and then does not add to the outstanding ones */
+    struct in_addr addr;
+    for (int i = 0; i < config->arp_probe_pool && arp_probe_outstanding() < config->arp_probe_pool &&
+                    next_pool_address(config, &addr) == OK; i++) {
+        arp_probe_start(addr, now, config->arp_probe_ttl);
+    }
+}
 
-    struct sockaddr_in broadcast_address = get_address(CLIENT_PORT, INADDR_BROADCAST);
-    while (send_packet(packet, sizeof(*packet), sock, &broadcast_address) == ERROR) {
-        printf("Error in sending packet... resending the packet\n");
+/* Answer the DISCOVERs still waiting for a probe after a handoff, without reading new requests. */
+void drain_pending_offers(int sock, const struct server_config *config) {
+    while (pending_count > 0) {
+        long wait = arp_probe_next_timeout(now_ms(), config->arp_probe_timeout);
+        if (wait < 0 || wait > PENDING_OFFER_TIMEOUT) wait = PENDING_OFFER_TIMEOUT;
+        fd_set read_fds;
+        FD_ZERO(&read_fds);
+        FD_SET(arp_sock, &read_fds);
+        struct timeval time_val = {wait / 1000, (wait % 1000) * 1000};
+        if (select(arp_sock + 1, &read_fds, NULL, NULL, &time_val) > 0) {
+            arp_probe_receive(now_ms(), config->arp_probe_ttl);
+        }
+        arp_probe_expire(now_ms(), config->arp_probe_timeout, config->arp_probe_ttl);
+        serve_pending_offers(sock, config);
     }
+}
 
-    fflush(stdout);
-    return OK;
+/* Milliseconds until a probe, the replication link or the quota sweep needs attention, -1 to block. */
+long next_timeout(const struct server_config *config) {
+    long now = now_ms();
+    long wait = probing(config) ? arp_probe_next_timeout(now, config->arp_probe_timeout) : -1;
+    long replication = replication_wait(now);
+    if (replication >= 0 && (wait < 0 || replication < wait)) wait = replication;
+    long sweep = quota_wait(now);
+    if (sweep >= 0 && (wait < 0 || sweep < wait)) wait = sweep;
+    return wait;
 }
 
 int serve_packet(int sock) {
     DHCP_packet packet;
     struct sockaddr_in source;
-    int result = receive_packet(&packet, sizeof(packet), sock, &source);
+    int result = receive_packet(&packet, sizeof(packet), sock, &source, next_timeout(config_get()));
 
-    if (result == ERROR) return ERROR;
-    if (packet.op != 1) return OK;
+    if (result == ERROR || result == HANDED_OFF) return result;
 
-    if (offer_count > END_IP) return OK;
+    const struct server_config *config = config_get();
+    if (probing(config)) run_probes(sock, config);
+    replication_run(now_ms());
+    quota_expire(now_ms());
 
-    int i = 4;
-    while (i < MAX_OPTIONS_LENGTH && packet.options[i] != 53 && packet.options[i] != '\xFF') {
-        i++;
-        int skip = (int) packet.options[i++];
-        while (skip--) i++;
+    if (result == NO_PACKET) return OK;
+    /* our ring saw what the predecessor's ring did before it handed over, and it answered those */
+    if (ring_sock >= 0 && (packet_received.tv_sec < last_served.tv_sec ||
+                           (packet_received.tv_sec == last_served.tv_sec &&
+                            packet_received.tv_nsec <= last_served.tv_nsec))) {
+        return OK;
     }
-    if (packet.options[i] == '\xFF') return OK;
+    last_served = packet_received;
+    DHCP_PROBE3(packet_received, ntohl(packet.xid), packet.chaddr, PROBE_NS(packet_received));
+    if (packet.op != BOOT_REQUEST || !replication_is_active()) return OK;
 
-    char type = packet.options[i + 2];
+    int type = dhcp_message_type(&packet);
+    DHCP_PROBE4(options_parsed, ntohl(packet.xid), packet.chaddr, type, PROBE_NS(packet_received));
 
     if (type == DHCP_DISCOVER) {
+        flood_note_discover(packet.giaddr, packet.chaddr, now_ms(), config->flood_threshold);
         printf("DHCP_DISCOVER from client\n");//IP address %s\n", inet_ntoa(source.sin_addr));
-        return send_DHCP_reply_packet(sock, &packet, DHCP_OFFER);
+        return send_DHCP_reply_packet(sock, &packet, DHCP_OFFER, config);
     }
     else if (type == DHCP_REQUEST) {
+        flood_note_request(packet.giaddr, now_ms());
+        /* a client selecting an offer names the server it chose in option 54, the others stay silent */
+        struct in_addr chosen;
+        if (dhcp_get_address(&packet, OPTION_SERVER_ID, &chosen) == OK && chosen.s_addr != server_ip.s_addr) {
+            printf("DHCP_REQUEST  for server %s\n", inet_ntoa(chosen));
+            withdraw_offer(packet.chaddr);
+            fflush(stdout);
+            return OK;
+        }
         printf("DHCP_REQUEST  from client\n");//IP address %s\n", inet_ntoa(source.sin_addr));
-        return send_DHCP_reply_packet(sock, &packet, DHCP_ACK);
+        return send_DHCP_reply_packet(sock, &packet, DHCP_ACK, config);
+    }
+    else if (type == DHCP_RELEASE) {
+        struct lease *lease = lease_find(packet.chaddr);
+        if (lease == NULL || lease->addr.s_addr != packet.ciaddr.s_addr) return OK;
+        printf("DHCP_RELEASE  of %s\n", inet_ntoa(packet.ciaddr));
+        lease = lease_update(packet.chaddr, packet.ciaddr, time(NULL));
+        quota_release(lease);
+        replication_note(lease);
+        fflush(stdout);
     }
 
     return OK;
 }
 
-int main() {
-    char interface_name[8] = "enp0s3";
+int main(int argc, char *argv[]) {
+    char *config_path = argc > 1 ? argv[1] : NULL;
 
     srand(time(NULL));
 
     puts("DHCP Server is starting");
 
-
-    int sock = create_DHCP_socket(interface_name);
+    /* the interface has to be known before the server address, which fills the other defaults */
+    struct server_config *config = config_load(config_path, server_ip);
+    if (config == NULL) exit(EXIT_FAILURE);
+    char interface_name[IFNAMSIZ], handoff_path[sizeof(config->handoff_socket)];
+    strcpy(interface_name, config->interface_name);
+    strcpy(handoff_path, config->handoff_socket);
+    config_free(config);
+
+    /* a server already running on handoff_path passes its sockets on instead of closing them */
+    int handed[HANDOFF_FD_COUNT];
+    int request = handoff_path[0] ? handoff_request(handoff_path, handed) : HANDOFF_NONE;
+    if (request == ERROR) exit(EXIT_FAILURE);
+    int taking_over = request == OK;
+    int sock;
+    if (taking_over) {
+        printf("Taking over from the running server\n");
+        sock = handed[HANDOFF_DHCP];
+        strcpy(interface.ifr_ifrn.ifrn_name, interface_name);
+    }
+    else {
+        sock = create_DHCP_socket(interface_name);
+    }
     ioctl(sock, SIOCGIFADDR, &interface);
     server_ip = ((struct sockaddr_in *) &interface.ifr_addr)->sin_addr;
 
-
-    normal = create_normal_socket(interface_name);
+    config = config_load(config_path, server_ip);
+    if (config == NULL) exit(EXIT_FAILURE);
+    config_publish(config);
+    /* before the reload thread starts, so a SIGHUP cannot free config while main still reads it */
+    config_register_reader();
+
+    normal = taking_over ? handed[HANDOFF_MESSAGES] : create_normal_socket(interface_name);
+    if (config->packet_ring) {
+        if ((ring_sock = ring_open(interface_name, SERVER_PORT)) < 0) exit(EXIT_FAILURE);
+        if (ring_mute_socket(sock) == ERROR) {
+            printf("Could not stop receiving on the DHCP socket\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    else if (taking_over && ring_unmute_socket(sock) == ERROR) {
+        /* a predecessor reading through a ring left its drop-all filter on the socket */
+        printf("Could not resume receiving on the DHCP socket\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->busy_poll) enable_busy_poll(ring_sock >= 0 ? ring_sock : sock, config->busy_poll);
+    if (taking_over && handed[HANDOFF_XDP_LINK] >= 0) {
+        if (config->xdp_filter) {
+            xdp_filter_adopt(handed[HANDOFF_XDP_LINK], handed[HANDOFF_XDP_COUNTERS]);
+        }
+        else {
+            close(handed[HANDOFF_XDP_LINK]);
+            close(handed[HANDOFF_XDP_COUNTERS]);
+        }
+    }
+    else if (config->xdp_filter && xdp_filter_open(interface_name, SERVER_PORT) == ERROR) {
+        exit(EXIT_FAILURE);
+    }
+    if (unicast_open(interface_name) < 0) exit(EXIT_FAILURE);
+    if (config->arp_probe && (arp_sock = arp_probe_open(interface_name)) < 0) exit(EXIT_FAILURE);
+    if (lease_table_init((u_int32_t) config->max_leases) == ERROR) {
+        printf("Could not allocate the lease table\n");
+        exit(EXIT_FAILURE);
+    }
+    if (config->replication_port) {
+        struct in_addr any = {INADDR_ANY};
+        replication_sock = replication_open(any, config->replication_port, config->replication_peer,
+                                            config->replication_active, config->failover_timeout,
+                                            taking_over ? handed[HANDOFF_REPLICATION] : -1);
+        if (replication_sock < 0) exit(EXIT_FAILURE);
+    }
+    else if (taking_over && handed[HANDOFF_REPLICATION] >= 0) {
+        close(handed[HANDOFF_REPLICATION]);
+    }
+    if (taking_over) {
+        int count = handoff_take_over(&last_served);
+        if (count == ERROR) {
+            printf("The running server did not hand over its leases\n");
+            exit(EXIT_FAILURE);
+        }
+        printf("Took over %d leases\n", count);
+    }
+    if (handoff_path[0]) {
+        if ((handoff_listener = handoff_listen(handoff_path)) < 0) exit(EXIT_FAILURE);
+        handoff_sock = handoff_listener;
+        handoff_fds[HANDOFF_DHCP] = sock;
+        handoff_fds[HANDOFF_MESSAGES] = normal;
+        handoff_fds[HANDOFF_REPLICATION] = replication_sock;
+        xdp_filter_fds(&handoff_fds[HANDOFF_XDP_LINK], &handoff_fds[HANDOFF_XDP_COUNTERS]);
+    }
     fflush(stdout);
 
     printf("MY IP address %s\n", inet_ntoa(server_ip));
+    config_print(config);
+    fflush(stdout);
 
-    while (serve_packet(sock) == OK);
+    if (config_path != NULL && config_start_reload_thread(config_path, server_ip) == ERROR) {
+        printf("Could not start the config reload thread\n");
+        exit(EXIT_FAILURE);
+    }
+    if (messages_start(normal) == ERROR) {
+        printf("Could not start the message threads\n");
+        exit(EXIT_FAILURE);
+    }
+    /* a reload may have replaced config by now, this thread keeps whatever it reads here alive */
+    const struct server_config *running = config_get();
+    if (running->query_socket[0] && query_start(running->query_socket) == ERROR) {
+        printf("Could not start the lease query service\n");
+        exit(EXIT_FAILURE);
+    }
+    /* after the other threads are started, they would inherit the mask */
+    if (running->pin_cpu >= 0) pin_packet_thread(running->pin_cpu);
+    if (running->spin_time && sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+        printf("spin_time on a single CPU takes it away from the kernel and other processes\n");
+    }
+    if (probing(config_get())) run_probes(sock, config_get());
+
+    int result;
+    while ((result = serve_packet(sock)) == OK) config_quiescent();
+
+    if (result == HANDED_OFF) {
+        messages_stop();
+        if (probing(config_get())) drain_pending_offers(sock, config_get());
+        printf("Handed over to the new server, exiting\n");
+        fflush(stdout);
+        return 0;
+    }
 
     close(sock);
     close(normal);
+    if (arp_sock >= 0) close(arp_sock);
+    if (replication_sock >= 0) close(replication_sock);
+    if (ring_sock >= 0) close(ring_sock);
 
     return 0;
 }
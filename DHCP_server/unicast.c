@@ -0,0 +1,88 @@
+#include "unicast.h"
+
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <net/ethernet.h>
+#include <net/if.h>
+#include <netinet/ip.h>
+#include <netinet/udp.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_FRAME_PAYLOAD 1472       /* Ethernet MTU minus IP and UDP headers */
+
+static int sock = -1;
+static int interface_index;
+
+int unicast_open(const char *interface_name) {
+    sock = socket(AF_PACKET, SOCK_DGRAM, htons(ETH_P_IP));
+    if (sock < 0) {
+        perror("Could not create unicast socket");
+        return ERROR;
+    }
+
+    struct ifreq request;
+    memset(&request, 0, sizeof(request));
+    strncpy(request.ifr_name, interface_name, IFNAMSIZ - 1);
+    if (ioctl(sock, SIOCGIFINDEX, &request) < 0) {
+        printf("Could not find interface %s for unicast replies\n", interface_name);
+        close(sock);
+        return sock = ERROR;
+    }
+    interface_index = request.ifr_ifindex;
+    return sock;
+}
+
+static u_int16_t checksum(const void *data, size_t length) {
+    const u_int16_t *words = data;
+    u_int32_t sum = 0;
+    while (length > 1) {
+        sum += *words++;
+        length -= 2;
+    }
+    if (length) sum += *(const u_int8_t *) words;
+    while (sum >> 16) sum = (sum & 0xFFFF) + (sum >> 16);
+    return (u_int16_t) ~sum;
+}
+
+int unicast_send(const void *payload, size_t length, struct in_addr source, in_port_t source_port,
+                 struct in_addr destination, in_port_t destination_port, const unsigned char *mac) {
+    if (sock < 0 || length > MAX_FRAME_PAYLOAD) return ERROR;
+
+    unsigned char frame[sizeof(struct iphdr) + sizeof(struct udphdr) + MAX_FRAME_PAYLOAD];
+    struct iphdr *ip = (struct iphdr *) frame;
+    struct udphdr *udp = (struct udphdr *) (frame + sizeof(*ip));
+    size_t total = sizeof(*ip) + sizeof(*udp) + length;
+
+    memset(ip, 0, sizeof(*ip));
+    ip->version = 4;
+    ip->ihl = sizeof(*ip) / 4;
+    ip->tot_len = htons((u_int16_t) total);
+    ip->ttl = 64;
+    ip->protocol = IPPROTO_UDP;
+    ip->saddr = source.s_addr;
+    ip->daddr = destination.s_addr;
+    ip->check = checksum(ip, sizeof(*ip));
+
+    udp->source = htons(source_port);
+    udp->dest = htons(destination_port);
+    udp->len = htons((u_int16_t) (sizeof(*udp) + length));
+    udp->check = 0;                  /* optional for UDP over IPv4 */
+    memcpy(frame + sizeof(*ip) + sizeof(*udp), payload, length);
+
+    struct sockaddr_ll address;
+    memset(&address, 0, sizeof(address));
+    address.sll_family = AF_PACKET;
+    address.sll_protocol = htons(ETH_P_IP);
+    address.sll_ifindex = interface_index;
+    address.sll_halen = ETH_ALEN;
+    memcpy(address.sll_addr, mac, ETH_ALEN);
+
+    return sendto(sock, frame, total, 0, (struct sockaddr *) &address, sizeof(address)) < 0 ? ERROR : OK;
+}
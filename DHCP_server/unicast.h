@@ -0,0 +1,20 @@
+#ifndef DHCP_SERVER_UNICAST_H
+#define DHCP_SERVER_UNICAST_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+/*
+ * Link-layer unicast for clients that have no address yet. The IP and UDP
+ * headers are built here and the frame goes straight to the client's hardware
+ * address, so there is no ARP lookup for an address the client does not own.
+ */
+
+/* Open the AF_PACKET socket used for sending on interface_name. Returns it, ERROR on failure. */
+int unicast_open(const char *interface_name);
+
+/* Send payload from source:source_port to destination:destination_port at hardware address mac. */
+int unicast_send(const void *payload, size_t length, struct in_addr source, in_port_t source_port,
+                 struct in_addr destination, in_port_t destination_port, const unsigned char *mac);
+
+#endif
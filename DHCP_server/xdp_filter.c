@@ -0,0 +1,169 @@
+#include "xdp_filter.h"
+#include "bpf_asm.h"
+
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#define OK 0
+#define ERROR -1
+
+/* frame offsets with a 20 byte IP header, which is all the filter inspects */
+#define IP_OFFSET      ETH_HLEN
+#define UDP_OFFSET     (IP_OFFSET + 20)
+#define DHCP_OFFSET    (UDP_OFFSET + 8)
+#define COOKIE_OFFSET  (DHCP_OFFSET + 236)
+#define OPTIONS_OFFSET (COOKIE_OFFSET + 4)
+#define OPTIONS_LIMIT  (COOKIE_OFFSET + 312)
+
+/* registers the program keeps */
+#define R_DATA     6
+#define R_VERDICT  7
+#define R_DATA_END 8
+#define R_OFFSET   9
+
+enum label {
+    LABEL_PASS,                      /* not for the server, pass uncounted */
+    LABEL_COUNT,                     /* count R_VERDICT, then pass or drop */
+    LABEL_PASSED,
+    LABEL_SHORT,
+    LABEL_NOT_REQUEST,
+    LABEL_HARDWARE,
+    LABEL_COOKIE,
+    LABEL_OPTIONS,
+    LABEL_LOOP,
+    LABEL_EXIT
+};
+
+static int map_fd = -1;
+static int link_fd = -1;
+static const char *verdict_names[XDP_VERDICT_COUNT] = {"passed", "short", "not_request", "hardware", "cookie",
+                                                       "options"};
+
+static void verdict_block(struct bpf_asm *a, enum label label, enum xdp_verdict verdict) {
+    bpf_asm_place(a, label);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, R_VERDICT, 0, 0, verdict);
+    bpf_asm_jump(a, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_COUNT);
+}
+
+static void assemble(struct bpf_asm *a, in_port_t port) {
+    bpf_asm_init(a);
+
+    /* r6 = ctx->data, r8 = ctx->data_end */
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, R_DATA, 1, offsetof(struct xdp_md, data), 0);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, R_DATA_END, 1, offsetof(struct xdp_md, data_end), 0);
+
+    /* Ethernet, IPv4 without options, UDP, not a fragment, to port */
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, R_DATA, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, DHCP_OFFSET);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 2, R_DATA_END, 0, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, 12, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(ETH_P_IP), LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, IP_OFFSET, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 0x45, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, IP_OFFSET + 9, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, IPPROTO_UDP, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, IP_OFFSET + 6, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JSET | BPF_K, 3, 0, htons(0x3FFF), LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, UDP_OFFSET + 2, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(port), LABEL_PASS);
+
+    /* fixed BOOTP header */
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, R_DATA, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, OPTIONS_OFFSET);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 2, R_DATA_END, 0, LABEL_SHORT);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, DHCP_OFFSET, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 1, LABEL_NOT_REQUEST);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, DHCP_OFFSET + 1, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 1, LABEL_HARDWARE);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, DHCP_OFFSET + 2, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, ETH_ALEN, LABEL_HARDWARE);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, 3, R_DATA, COOKIE_OFFSET, 0);
+    u_int32_t cookie;
+    memcpy(&cookie, "\x63\x82\x53\x63", 4);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, (int32_t) cookie, LABEL_COOKIE);
+
+    /*
+     * Walk the options to OPTION_END. The offset grows by at least one byte per
+     * round and is bounded by OPTIONS_LIMIT, which is what lets the verifier
+     * accept the loop.
+     */
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, R_OFFSET, 0, 0, OPTIONS_OFFSET);
+    bpf_asm_place(a, LABEL_LOOP);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGE | BPF_K, R_OFFSET, 0, OPTIONS_LIMIT, LABEL_OPTIONS);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, R_DATA, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_X, 2, R_OFFSET, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 3, 2, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, 1);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 3, R_DATA_END, 0, LABEL_OPTIONS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 4, 2, 0, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 255, LABEL_PASSED);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, R_OFFSET, 0, 0, 1);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 0, LABEL_LOOP);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, 1);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 3, R_DATA_END, 0, LABEL_OPTIONS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 4, 2, 1, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, R_OFFSET, 0, 0, 1);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_X, R_OFFSET, 4, 0, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_LOOP);
+
+    verdict_block(a, LABEL_PASSED, XDP_PASSED);
+    verdict_block(a, LABEL_SHORT, XDP_DROP_SHORT);
+    verdict_block(a, LABEL_NOT_REQUEST, XDP_DROP_NOT_REQUEST);
+    verdict_block(a, LABEL_HARDWARE, XDP_DROP_HARDWARE);
+    verdict_block(a, LABEL_COOKIE, XDP_DROP_COOKIE);
+    verdict_block(a, LABEL_OPTIONS, XDP_DROP_OPTIONS);
+
+    /* counters[verdict]++ on this CPU, then drop everything but XDP_PASSED */
+    bpf_asm_place(a, LABEL_COUNT);
+    bpf_asm_count(a, R_VERDICT, map_fd);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_DROP);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, R_VERDICT, 0, XDP_PASSED, LABEL_EXIT);
+
+    bpf_asm_place(a, LABEL_PASS);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+    bpf_asm_place(a, LABEL_EXIT);
+    bpf_asm_emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+int xdp_filter_open(const char *interface_name, in_port_t port) {
+    map_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(u_int32_t), sizeof(u_int64_t), XDP_VERDICT_COUNT);
+    if (map_fd < 0) return ERROR;
+
+    static struct bpf_asm program;
+    assemble(&program, port);
+    int program_fd = bpf_asm_load_xdp(&program);
+    if (program_fd >= 0) {
+        link_fd = bpf_attach_xdp(program_fd, interface_name);
+        close(program_fd);
+        if (link_fd >= 0) return OK;
+    }
+
+    close(map_fd);
+    map_fd = -1;
+    return ERROR;
+}
+
+void xdp_filter_adopt(int link, int counters) {
+    link_fd = link;
+    map_fd = counters;
+}
+
+void xdp_filter_fds(int *link, int *counters) {
+    *link = link_fd;
+    *counters = map_fd;
+}
+
+int xdp_filter_format(char *buffer, size_t size) {
+    if (map_fd < 0) return 0;
+
+    int length = 0;
+    for (u_int32_t verdict = 0; verdict < XDP_VERDICT_COUNT; verdict++) {
+        length += snprintf(buffer + length, size - length, " xdp_%s=%llu", verdict_names[verdict],
+                           (unsigned long long) bpf_map_sum(map_fd, verdict));
+        if (length >= (int) size) return (int) size - 1;
+    }
+    return length;
+}
@@ -0,0 +1,39 @@
+#ifndef DHCP_SERVER_XDP_FILTER_H
+#define DHCP_SERVER_XDP_FILTER_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+
+/*
+ * Optional XDP program on the serving interface. Unfragmented IPv4 UDP to the
+ * server port has to be a BOOTREQUEST with an Ethernet hardware address, the
+ * magic cookie and an option list that ends in OPTION_END inside the frame;
+ * anything else is dropped in the driver, before an skb or a wakeup is spent
+ * on it. Other traffic passes untouched. The program is assembled here, so no
+ * BPF compiler is needed, and it is detached when the server exits, unless an
+ * upgrade took it over.
+ */
+
+enum xdp_verdict {
+    XDP_PASSED = 0,                  /* well formed request, handed to the stack */
+    XDP_DROP_SHORT,                  /* frame ends before the magic cookie */
+    XDP_DROP_NOT_REQUEST,            /* op is not BOOT_REQUEST */
+    XDP_DROP_HARDWARE,               /* htype or hlen is not Ethernet */
+    XDP_DROP_COOKIE,                 /* magic cookie missing */
+    XDP_DROP_OPTIONS,                /* an option runs past the frame or there is no OPTION_END */
+    XDP_VERDICT_COUNT
+};
+
+/* Load and attach the filter for UDP destination port. Returns OK, ERROR on failure. */
+int xdp_filter_open(const char *interface_name, in_port_t port);
+
+/* Keep the link and counter map of a filter attached by the server this one took over from. */
+void xdp_filter_adopt(int link, int counters);
+
+/* The link and counter map fds, -1 if not attached. */
+void xdp_filter_fds(int *link, int *counters);
+
+/* Append " xdp_<verdict>=<count> ..." from the per-CPU counter map, returns the length (0 if not attached). */
+int xdp_filter_format(char *buffer, size_t size);
+
+#endif
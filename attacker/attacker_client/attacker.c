@@ -11,52 +11,28 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../../common/dhcp.h"
+
 #define OK 0
 #define ERROR -1
 
-#define MAX_CHADDR_LENGTH  16
-#define MAX_SNAME_LENGTH   64
-#define MAX_FILE_LENGTH    128
-#define MAX_OPTIONS_LENGTH 312
-
-struct DHCP_packet {
-    u_int8_t op;                             /* packet type */
-    u_int8_t htype;                          /* type of hardware address for this machine (Ethernet, etc) */
-    u_int8_t hlen;                           /* length of hardware address (of this machine) */
-    u_int8_t hops;                           /* hops */
-    u_int32_t xid;                           /* random transaction id number - chosen by this machine */
-    u_int16_t secs;                          /* seconds used in timing */
-    u_int16_t flags;                         /* flags */
-    struct in_addr ciaddr;                   /* IP address of this machine (if we already have one) */
-    struct in_addr yiaddr;                   /* IP address of this machine (offered by the DHCP server) */
-    struct in_addr siaddr;                   /* IP address of DHCP server */
-    struct in_addr giaddr;                   /* IP address of DHCP relay */
-    unsigned char chaddr[MAX_CHADDR_LENGTH]; /* hardware address of this machine */
-    char sname[MAX_SNAME_LENGTH];            /* name of DHCP server */
-    char file[MAX_FILE_LENGTH];              /* boot file name (used for disk-less booting?) */
-    char options[MAX_OPTIONS_LENGTH];        /* options */
-};
-typedef struct DHCP_packet DHCP_packet;
-
-#define BOOT_REQUEST 1
-
-#define DHCP_DISCOVER 1
-#define DHCP_REQUEST  3
-// #define DHCP_OFFER    2
-// #define DHCP_ACK      5
-// #define DHCP_NACK     6
-
-#define OPTION_MESSAGE_TYPE    53
-#define OPTION_ADDRESS_REQUEST 50
-#define OPTION_SERVER_ID       54
-
-#define BROADCAST_FLAG 0x8000
-
 #define SERVER_PORT 67
-#define CLIENT_PORT 68
 
-#define HTYPE 1
-#define HLEN  6
+/* option layout of DISCOVER */
+enum discover_layout {
+    DISCOVER_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    DISCOVER_END = DISCOVER_MESSAGE_TYPE + DHCP_OPTION_SIZE(1)
+};
+DHCP_CHECK_LAYOUT(DISCOVER_END + 1);
+
+/* option layout of REQUEST */
+enum request_layout {
+    REQUEST_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    REQUEST_ADDRESS = REQUEST_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    REQUEST_SERVER_ID = REQUEST_ADDRESS + DHCP_OPTION_SIZE(4),
+    REQUEST_END = REQUEST_SERVER_ID + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(REQUEST_END + 1);
 
 unsigned char random_mac[MAX_CHADDR_LENGTH];
 u_int32_t transaction_id = 0;
@@ -158,13 +134,6 @@ int make_random_hardware_address() {
     return OK;
 }
 
-void set_magic_cookie(DHCP_packet *packet) {
-    packet->options[0] = '\x63';
-    packet->options[1] = '\x82';
-    packet->options[2] = '\x53';
-    packet->options[3] = '\x63';
-}
-
 int get_DHCP_offer_packet(int sock);
 
 int send_DHCP_discover_packet(int sock) {
@@ -183,15 +152,11 @@ int send_DHCP_discover_packet(int sock) {
     memcpy(discover_packet.chaddr, random_mac, HLEN);
 
     set_magic_cookie(&discover_packet);
-
-    discover_packet.options[4] = OPTION_MESSAGE_TYPE;
-    discover_packet.options[5] = 1;
-    discover_packet.options[6] = DHCP_DISCOVER;
-
-    discover_packet.options[7] = '\xFF';
+    dhcp_put_u8(&discover_packet, DISCOVER_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_DISCOVER);
+    int length = (int) dhcp_finish(&discover_packet, DISCOVER_END);
 
     struct sockaddr_in broadcast_address = get_address(SERVER_PORT, INADDR_BROADCAST);
-    while (send_packet(&discover_packet, sizeof(discover_packet), sock, &broadcast_address) == ERROR) {
+    while (send_packet(&discover_packet, length, sock, &broadcast_address) == ERROR) {
         printf("Error in sending packet... resending the packet\n");
     }
 
@@ -219,25 +184,15 @@ int send_DHCP_request_packet(int sock, struct in_addr server_ip) {
     memcpy(request_packet.chaddr, random_mac, HLEN);
 
     set_magic_cookie(&request_packet);
-
-    request_packet.options[4] = OPTION_MESSAGE_TYPE;
-    request_packet.options[5] = 1;
-    request_packet.options[6] = DHCP_REQUEST;
-
-    request_packet.options[7] = OPTION_ADDRESS_REQUEST;
-    request_packet.options[8] = 4;
-    memcpy(request_packet.options+9, &offered_address, 4);
-
-    request_packet.options[13] = OPTION_SERVER_ID;
-    request_packet.options[14] = 4;
-    memcpy(request_packet.options+15, &server_ip, 4);
-
-    request_packet.options[19] = '\xFF';
+    dhcp_put_u8(&request_packet, REQUEST_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_REQUEST);
+    dhcp_put_address(&request_packet, REQUEST_ADDRESS, OPTION_ADDRESS_REQUEST, offered_address);
+    dhcp_put_address(&request_packet, REQUEST_SERVER_ID, OPTION_SERVER_ID, server_ip);
+    int length = (int) dhcp_finish(&request_packet, REQUEST_END);
 
     printf("Requesting Address: %s\n", inet_ntoa(offered_address));
 
     struct sockaddr_in broadcast_address = get_address(SERVER_PORT, INADDR_BROADCAST);
-    while (send_packet(&request_packet, sizeof(request_packet), sock, &broadcast_address) == ERROR) {
+    while (send_packet(&request_packet, length, sock, &broadcast_address) == ERROR) {
         printf("Error in sending packet... resending the packet\n");
     }
 
@@ -255,7 +210,7 @@ int get_DHCP_offer_packet(int sock) {
         int result = receive_packet(&offer_packet, sizeof(offer_packet), sock, &source);
 
         if (result == ERROR) return ERROR;
-        if(offer_packet.op != 2) continue;
+        if(offer_packet.op != BOOT_REPLY) continue;
 
         if (ntohl(offer_packet.xid) != transaction_id) {
             continue;
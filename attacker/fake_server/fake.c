@@ -12,54 +12,23 @@
 #include <time.h>
 #include <unistd.h>
 
+#include "../../common/dhcp.h"
+
 #define OK 0
 #define ERROR -1
 
-#define MAX_CHADDR_LENGTH  16
-#define MAX_SNAME_LENGTH   64
-#define MAX_FILE_LENGTH    128
-#define MAX_OPTIONS_LENGTH 312
-
-struct DHCP_packet {
-    u_int8_t op;                             /* packet type */
-    u_int8_t htype;                          /* type of hardware address for this machine (Ethernet, etc) */
-    u_int8_t hlen;                           /* length of hardware address (of this machine) */
-    u_int8_t hops;                           /* hops */
-    u_int32_t xid;                           /* random transaction id number - chosen by this machine */
-    u_int16_t secs;                          /* seconds used in timing */
-    u_int16_t flags;                         /* flags */
-    struct in_addr ciaddr;                   /* IP address of this machine (if we already have one) */
-    struct in_addr yiaddr;                   /* IP address of this machine (offered by the DHCP server) */
-    struct in_addr siaddr;                   /* IP address of DHCP server */
-    struct in_addr giaddr;                   /* IP address of DHCP relay */
-    unsigned char chaddr[MAX_CHADDR_LENGTH]; /* hardware address of this machine */
-    char sname[MAX_SNAME_LENGTH];            /* name of DHCP server */
-    char file[MAX_FILE_LENGTH];              /* boot file name (used for disk-less booting?) */
-    char options[MAX_OPTIONS_LENGTH];        /* options */
-};
-typedef struct DHCP_packet DHCP_packet;
-
-#define DHCP_DISCOVER 1
-#define DHCP_OFFER    2
-#define DHCP_REQUEST  3
-#define DHCP_ACK      5
-#define DHCP_NACK     6
-
-#define BROADCAST_FLAG 0x8000
-
 #define SERVER_PORT 67
-#define CLIENT_PORT 68
-
-#define HTYPE 1
-#define HLEN  6
 
-#define OPTION_ADDRESS_REQUEST 50
-#define OPTION_LEASE_TIME 51
-#define OPTION_MESSAGE_TYPE    53
-
-#define OPTION_SERVER_ID       54
-#define OPTION_DEFAULT_GATEWAY_ROUTER_ID 3
-#define OPTION_DNS_SERVER_ID 6
+/* option layout of OFFER and ACK, every server address option points at us */
+enum reply_layout {
+    REPLY_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    REPLY_ROUTER = REPLY_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    REPLY_SERVER_ID = REPLY_ROUTER + DHCP_OPTION_SIZE(4),
+    REPLY_DNS = REPLY_SERVER_ID + DHCP_OPTION_SIZE(4),
+    REPLY_LEASE_TIME = REPLY_DNS + DHCP_OPTION_SIZE(4),
+    REPLY_END = REPLY_LEASE_TIME + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(REPLY_END + 1);
 
 #define START_IP 101
 #define END_IP 150
@@ -179,35 +148,18 @@ int receive_packet(void *buffer, size_t buffer_size, int sock, struct sockaddr_i
     else if (FD_ISSET(sock, &read_fds)) {
         socklen_t address_size = sizeof(*source_address);
         memset(source_address, 0, address_size);
-        memset(buffer, 0, sizeof(*buffer));
         int received_data =
                 (int) recvfrom(sock, buffer, buffer_size, 0, (struct sockaddr *) source_address, &address_size);
+        if (received_data == -1) return ERROR;
 
-        return (received_data == -1) ? ERROR : OK;
+        memset((char *) buffer + received_data, 0, buffer_size - received_data);
+        return OK;
     }
     else {
         return ERROR;
     }
 }
 
-void set_magic_cookie(DHCP_packet *packet) {
-    packet->options[0] = '\x63';
-    packet->options[1] = '\x82';
-    packet->options[2] = '\x53';
-    packet->options[3] = '\x63';
-}
-
-void set_server_ip(DHCP_packet *packet, int pos) {
-    uint32_t ip = server_ip.s_addr;
-    packet->options[pos] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 1] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 2] = (char) (ip & 0x000000FF);
-    ip >>= 8;
-    packet->options[pos + 3] = (char) (ip & 0x000000FF);
-}
-
 struct in_addr make_offer_ip() {
     struct in_addr addr = server_ip;
     addr.s_addr &= 0x00FFFFFF;
@@ -217,7 +169,7 @@ struct in_addr make_offer_ip() {
 }
 
 int send_DHCP_reply_packet(int sock, DHCP_packet *packet, char type) {
-    packet->op = 2;
+    packet->op = BOOT_REPLY;
 
     if (type == DHCP_OFFER) {
         packet->ciaddr.s_addr = 0;
@@ -228,54 +180,24 @@ int send_DHCP_reply_packet(int sock, DHCP_packet *packet, char type) {
     }
     else if (type == DHCP_ACK) {
         //packet->yiaddr = packet->ciaddr;
-	int i = 4;
- 	while (i < MAX_OPTIONS_LENGTH && packet->options[i] != 50 && packet->options[i] != '\xFF') {
-            i++;
-            int skip = (int) packet->options[i++];
-            while (skip--) i++;
-        }
-        if (packet->options[i] == '\xFF') return OK;
-
-        packet->yiaddr.s_addr = 0;
-        packet->yiaddr.s_addr |= ((int) packet->options[i + 2] & 0x000000FF);
-        packet->yiaddr.s_addr |= ((int) packet->options[i + 3] & 0x000000FF) << 8;
-        packet->yiaddr.s_addr |= ((int) packet->options[i + 4] & 0x000000FF) << 16;
-        packet->yiaddr.s_addr |= ((int) packet->options[i + 5] & 0x000000FF) << 24;
-        
+        if (dhcp_get_address(packet, OPTION_ADDRESS_REQUEST, &packet->yiaddr) == ERROR) return OK;
+
         packet->ciaddr.s_addr = 0;
         packet->giaddr.s_addr = 0;
         packet->siaddr = server_ip;
         printf("Grant IP: %s\n", inet_ntoa(packet->yiaddr));
     }
 
-    bzero(packet->options, sizeof(packet->options));
     set_magic_cookie(packet);
-
-    packet->options[4] = OPTION_MESSAGE_TYPE; // message type
-    packet->options[5] = 1;
-    packet->options[6] = type;
-
-    packet->options[7] = OPTION_DEFAULT_GATEWAY_ROUTER_ID; // default gateway router IP
-    packet->options[8] = 4;
-    set_server_ip(packet, 9);
-
-    packet->options[13] = OPTION_LEASE_TIME; // lease time
-    packet->options[14] = 4;
-    char lease[4] = {120, 0, 0, 0};
-    memcpy(packet->options + 15, lease, 4); // time = 120 seconds
-
-    packet->options[13] = OPTION_SERVER_ID; // DHCP server IP
-    packet->options[14] = 4;
-    set_server_ip(packet, 15);
-
-    packet->options[19] = OPTION_DNS_SERVER_ID; // DNS server IP
-    packet->options[20] = 4;
-    set_server_ip(packet, 21);
-
-    packet->options[25] = '\xFF';
+    dhcp_put_u8(packet, REPLY_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, type);
+    dhcp_put_address(packet, REPLY_ROUTER, OPTION_DEFAULT_GATEWAY_ROUTER_ID, server_ip);
+    dhcp_put_address(packet, REPLY_SERVER_ID, OPTION_SERVER_ID, server_ip);
+    dhcp_put_address(packet, REPLY_DNS, OPTION_DNS_SERVER_ID, server_ip);
+    dhcp_put_u32(packet, REPLY_LEASE_TIME, OPTION_LEASE_TIME, 120); // time = 120 seconds
+    int length = (int) dhcp_finish(packet, REPLY_END);
 
     struct sockaddr_in broadcast_address = get_address(CLIENT_PORT, INADDR_BROADCAST);
-    while (send_packet(packet, sizeof(*packet), sock, &broadcast_address) == ERROR) {
+    while (send_packet(packet, length, sock, &broadcast_address) == ERROR) {
         printf("Error in sending packet... resending the packet\n");
     }
 
@@ -289,19 +211,11 @@ int serve_packet(int sock) {
     int result = receive_packet(&packet, sizeof(packet), sock, &source);
 
     if (result == ERROR) return ERROR;
-    if (packet.op != 1) return OK;
+    if (packet.op != BOOT_REQUEST) return OK;
 
     if (offer_count > END_IP) return OK;
 
-    int i = 4;
-    while (i < MAX_OPTIONS_LENGTH && packet.options[i] != 53 && packet.options[i] != '\xFF') {
-        i++;
-        int skip = (int) packet.options[i++];
-        while (skip--) i++;
-    }
-    if (packet.options[i] == '\xFF') return OK;
-
-    char type = packet.options[i + 2];
+    int type = dhcp_message_type(&packet);
 
     if (type == DHCP_DISCOVER) {
         printf("DHCP_DISCOVER from client\n");//IP address %s\n", inet_ntoa(source.sin_addr));
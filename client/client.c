@@ -1,339 +1,227 @@
 #include <arpa/inet.h>
-#include <locale.h>
-#include <net/if.h>
 #include <netinet/in.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/socket.h>
-#include <sys/time.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
 
+#include "dhcp_client.h"
+
 #define OK 0
 #define ERROR -1
 
 #define MAX_MSG_LENGTH 100
+#define MAX_MESSAGES   5
+#define MAX_INTERFACES 64
 
-#define MAX_CHADDR_LENGTH  16
-#define MAX_SNAME_LENGTH   64
-#define MAX_FILE_LENGTH    128
-#define MAX_OPTIONS_LENGTH 312
-
-struct DHCP_packet {
-    u_int8_t op;                             /* packet type */
-    u_int8_t htype;                          /* type of hardware address for this machine (Ethernet, etc) */
-    u_int8_t hlen;                           /* length of hardware address (of this machine) */
-    u_int8_t hops;                           /* hops */
-    u_int32_t xid;                           /* random transaction id number - chosen by this machine */
-    u_int16_t secs;                          /* seconds used in timing */
-    u_int16_t flags;                         /* flags */
-    struct in_addr ciaddr;                   /* IP address of this machine (if we already have one) */
-    struct in_addr yiaddr;                   /* IP address of this machine (offered by the DHCP server) */
-    struct in_addr siaddr;                   /* IP address of DHCP server */
-    struct in_addr giaddr;                   /* IP address of DHCP relay */
-    unsigned char chaddr[MAX_CHADDR_LENGTH]; /* hardware address of this machine */
-    char sname[MAX_SNAME_LENGTH];            /* name of DHCP server */
-    char file[MAX_FILE_LENGTH];              /* boot file name (used for disk-less booting?) */
-    char options[MAX_OPTIONS_LENGTH];        /* options */
-};
-typedef struct DHCP_packet DHCP_packet;
-
-#define BOOT_REQUEST 1
-
-#define DHCP_DISCOVER 1
-#define DHCP_OFFER    2
-#define DHCP_REQUEST  3
-#define DHCP_ACK      5
-#define DHCP_NACK     6
-
-#define OPTION_MESSAGE_TYPE    53
-#define OPTION_ADDRESS_REQUEST 50
-#define OPTION_SERVER_ID       54
-
-#define BROADCAST_FLAG 0x8000
+#define DEFAULT_INTERFACE  "enp0s3"
+#define DEFAULT_LEASE_FILE "client.lease"
 
-#define SERVER_PORT 66
-#define CLIENT_PORT 68
+struct dhcp_client *clients[MAX_INTERFACES];
+int client_count = 0;
+int started = 0;      /* every interface has had its first outcome */
 
-#define HTYPE 1
-#define HLEN  6
-
-unsigned char random_mac[MAX_CHADDR_LENGTH];
-u_int32_t transaction_id = 0;
-struct in_addr offered_address;
-
-struct in_addr default_gateway;
+long now_ms() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec * 1000L + now.tv_nsec / 1000000;
+}
 
-struct sockaddr_in get_address(in_port_t port, in_addr_t ip) {
-    struct sockaddr_in address;
-    address.sin_family = AF_INET;
-    address.sin_port = htons(port);
-    address.sin_addr.s_addr = ip;
-    bzero(&address.sin_zero, sizeof(address.sin_zero));
-    return address;
+int has_lease(struct dhcp_client *client) {
+    enum dhcp_client_state state = dhcp_client_state(client);
+    return state == CLIENT_BOUND || state == CLIENT_RENEWING || state == CLIENT_REBINDING;
 }
 
-int create_DHCP_socket(char *interface_name) {
-    int sock = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP);
-    if (sock < 0) {
-        printf("Could not create socket\n");
-        exit(EXIT_FAILURE);
+/* The interface messages go out on: the first one that holds a lease. */
+struct dhcp_client *message_client() {
+    for (int i = 0; i < client_count; i++) {
+        if (has_lease(clients[i])) return clients[i];
     }
+    return NULL;
+}
 
-    printf("New socket created\n");
-
-    int opt_val = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val)) < 0) {
-        printf(" Could not set reuse address option on DHCP socket!\n");
-        exit(EXIT_FAILURE);
-    }
-    opt_val = 1;
-    if (setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &opt_val, sizeof opt_val) < 0) {
-        printf(" Could not set broadcast option on DHCP socket!\n");
-        exit(EXIT_FAILURE);
+void report_event(struct dhcp_client *client, enum dhcp_client_event event, void *context) {
+    (void) context;
+    if (started && event == DHCP_CLIENT_BOUND && client == message_client()) {
+        printf("Default Gateway is: %s\n", inet_ntoa(dhcp_client_lease(client)->router));
     }
-    struct ifreq interface;
-    strcpy(interface.ifr_ifrn.ifrn_name, interface_name);
-    if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, &interface, sizeof(interface)) < 0) {
-        printf("\tCould not bind socket to interface %s. Check your privileges...\n", interface_name);
-        exit(EXIT_FAILURE);
-    }
-    struct sockaddr_in client_address = get_address(CLIENT_PORT, INADDR_ANY);
-    if (bind(sock, (struct sockaddr *) &client_address, sizeof(client_address)) < 0) {
-        printf("\tCould not bind to DHCP socket (port %d)! Check your privileges...\n", CLIENT_PORT);
-        exit(EXIT_FAILURE);
-    }
-
-    return sock;
+    fflush(stdout);
 }
 
-int send_packet(void *buffer, int buffer_size, int sock, struct sockaddr_in *dest) {
-    int result = (int) sendto(sock, buffer, buffer_size, 0, (struct sockaddr *) dest, sizeof(*dest));
-
-    if (result < 0) {
-        return ERROR;
+int send_normal_packet(struct dhcp_client *client, char *s) {
+    struct sockaddr_in default_address;
+    memset(&default_address, 0, sizeof(default_address));
+    default_address.sin_family = AF_INET;
+    default_address.sin_port = htons(547);
+    default_address.sin_addr = dhcp_client_lease(client)->router;
+    while (sendto(dhcp_client_fd(client), s, MAX_MSG_LENGTH, 0, (struct sockaddr *) &default_address,
+                  sizeof(default_address)) < 0) {
+        printf("Error in sending packet... resending the packet\n");
     }
     return OK;
 }
 
-int receive_packet(void *buffer, size_t buffer_size, int sock, struct sockaddr_in *source_address) {
-    time_t timeout = 2;
-    struct timeval time_val;
-    time_val.tv_sec = timeout;
-    time_val.tv_usec = 0;
-
-    fd_set read_fds;
-    FD_ZERO(&read_fds);
-    FD_SET(sock, &read_fds);
-
-    select(sock + 1, &read_fds, NULL, NULL, &time_val);
-
-    if (!FD_ISSET(sock, &read_fds)) {
-        printf("No (more) data received\n");
-        return ERROR;
+/*
+ * Sleep until a socket is readable or the earliest client timer, then
+ * dispatch. Returns 1 if stdin (registered with a NULL pointer) is readable.
+ */
+int poll_clients(int epoll_fd) {
+    long next = -1;
+    for (int i = 0; i < client_count; i++) {
+        long timer = dhcp_client_next_timer(clients[i]);
+        if (timer >= 0 && (next < 0 || timer < next)) next = timer;
     }
-    else {
-        socklen_t address_size = sizeof(*source_address);
-        memset(source_address, 0, address_size);
-        memset(buffer, 0, sizeof(*buffer));
-        int received_data =
-                (int) recvfrom(sock, buffer, buffer_size, 0, (struct sockaddr *) source_address, &address_size);
-
-        return (received_data == -1) ? ERROR : OK;
-    }
-}
-
-int make_random_hardware_address() {
-    for (int i = 0; i < HLEN; i++) {
-        random_mac[i] = rand() % 0x100;
+    long wait = next < 0 ? -1 : next - now_ms();
+    if (next >= 0 && wait < 0) wait = 0;
+
+    struct epoll_event events[MAX_INTERFACES + 1];
+    int count = epoll_wait(epoll_fd, events, MAX_INTERFACES + 1, (int) wait);
+    long now = now_ms();
+    int stdin_ready = 0;
+    for (int i = 0; i < count; i++) {
+        if (events[i].data.ptr == NULL) stdin_ready = 1;
+        else dhcp_client_input(events[i].data.ptr, now);
     }
-
-    printf("Random MAC Address: ");
-    for (int i = 0; i < HLEN; i++) {
-        if (i > 0) {
-            printf(":");
-        }
-        printf("%x", random_mac[i]);
+    for (int i = 0; i < client_count; i++) {
+        long timer = dhcp_client_next_timer(clients[i]);
+        if (timer >= 0 && timer <= now) dhcp_client_timer(clients[i], now);
     }
-    puts("");
-
-    return OK;
-}
-
-void set_magic_cookie(DHCP_packet *packet) {
-    packet->options[0] = '\x63';
-    packet->options[1] = '\x82';
-    packet->options[2] = '\x53';
-    packet->options[3] = '\x63';
+    fflush(stdout);
+    return stdin_ready;
 }
 
-int get_DHCP_reply_packet(int sock, char type);
-
-int send_DHCP_discover_packet(int sock) {
-    DHCP_packet discover_packet;
-    bzero(&discover_packet, sizeof(discover_packet));
-
-    discover_packet.op = BOOT_REQUEST;
-    discover_packet.htype = HTYPE;
-    discover_packet.hlen = HLEN;
-    discover_packet.hops = 0;
-
-    transaction_id = rand();
-    discover_packet.xid = htonl(transaction_id);
-    discover_packet.secs = htons(0x00);
-    discover_packet.flags = htons(BROADCAST_FLAG);
-    memcpy(discover_packet.chaddr, random_mac, HLEN);
-
-    set_magic_cookie(&discover_packet);
-
-    discover_packet.options[4] = OPTION_MESSAGE_TYPE;
-    discover_packet.options[5] = 1;
-    discover_packet.options[6] = DHCP_DISCOVER;
-
-    discover_packet.options[7] = '\xFF';
-
-    struct sockaddr_in broadcast_address = get_address(SERVER_PORT, INADDR_BROADCAST);
-    while (send_packet(&discover_packet, sizeof(discover_packet), sock, &broadcast_address) == ERROR) {
-        printf("Error in sending packet... resending the packet\n");
+int all_settled() {
+    for (int i = 0; i < client_count; i++) {
+        if (!has_lease(clients[i]) && dhcp_client_state(clients[i]) != CLIENT_FAILED) return 0;
     }
-
-    get_DHCP_reply_packet(sock, DHCP_OFFER);
-
-    return OK;
+    return 1;
 }
 
-int send_DHCP_request_packet(int sock, struct in_addr server_ip) {
-    DHCP_packet request_packet;
-    memset(&request_packet, 0, sizeof(request_packet));
-
-    request_packet.op = BOOT_REQUEST;
-    request_packet.htype = HTYPE;
-    request_packet.hlen = HLEN;
-    request_packet.hops = 0;
-
-    request_packet.xid = htonl(transaction_id);
-
-    request_packet.secs = htons(0x00);
-    request_packet.flags = htons(BROADCAST_FLAG);
-    request_packet.ciaddr = offered_address;
-    request_packet.siaddr = server_ip;
-
-    memcpy(request_packet.chaddr, random_mac, HLEN);
-
-    set_magic_cookie(&request_packet);
-
-    request_packet.options[4] = OPTION_MESSAGE_TYPE;
-    request_packet.options[5] = 1;
-    request_packet.options[6] = DHCP_REQUEST;
-
-    request_packet.options[7] = OPTION_ADDRESS_REQUEST;
-    request_packet.options[8] = 4;
-    memcpy(request_packet.options+9, &offered_address, 4);
-
-    request_packet.options[13] = OPTION_SERVER_ID;
-    request_packet.options[14] = 4;
-    memcpy(request_packet.options+15, &server_ip, 4);
-
-    request_packet.options[19] = '\xFF';
-
-    printf("Requesting Address: %s\n", inet_ntoa(offered_address));
+/*
+ * Send the messages typed on stdin to the gateway while the leases are kept
+ * alive by the same loop. Ends after MAX_MESSAGES messages or at the end of
+ * stdin.
+ */
+void run_messages(int epoll_fd) {
+    /* a regular file cannot be watched, but it never blocks either */
+    struct epoll_event event = {.events = EPOLLIN, .data.ptr = NULL};
+    int file_input = epoll_ctl(epoll_fd, EPOLL_CTL_ADD, STDIN_FILENO, &event) < 0;
+
+    int messages = 0, prompted = 0;
+    while (messages < MAX_MESSAGES) {
+        if (!prompted) {
+            printf("Enter message: ");
+            fflush(stdout);
+            prompted = 1;
+        }
+        if (!file_input && !poll_clients(epoll_fd)) continue;
 
-    struct sockaddr_in broadcast_address = get_address(SERVER_PORT, INADDR_BROADCAST);
-    while (send_packet(&request_packet, sizeof(request_packet), sock, &broadcast_address) == ERROR) {
-        printf("Error in sending packet... resending the packet\n");
+        size_t len = MAX_MSG_LENGTH;
+        char *s = (char*)malloc(len);
+        if (getline(&s, &len, stdin) < 0) {
+            free(s);
+            break;
+        }
+        struct dhcp_client *client = message_client();
+        if (client) send_normal_packet(client, s);
+        free(s);
+        messages++;
+        prompted = 0;
     }
-
-    get_DHCP_reply_packet(sock, DHCP_ACK);
-
-    return OK;
 }
 
-int get_DHCP_reply_packet(int sock, char type) {
-    time_t start_time = time(NULL), timeout = 5;
-    while (1) {
-        time_t current_time = time(NULL);
-        if (current_time - start_time > timeout) break;
-
-        DHCP_packet packet;
-        struct sockaddr_in source;
-        int result = receive_packet(&packet, sizeof(packet), sock, &source);
-
-        if (result == ERROR) return ERROR;
-        if (packet.op != 2) continue;
+void usage(char *name) {
+    printf("Usage: %s [-i interface]... [-t seconds to acquire a lease] [-f lease file] [-w ms to collect offers]"
+           " [-s trusted server]... [-T trace file]\n", name);
+    printf("With more than one interface each keeps its lease in the lease file name followed by .interface\n");
+    printf("The trace gets a JSON line per DHCP message sent or received, - writes it to stdout\n");
+    exit(EXIT_FAILURE);
+}
 
-        if (ntohl(packet.xid) != transaction_id) {
-            continue;
+int main(int argc, char *argv[]) {
+    char *interface_names[MAX_INTERFACES];
+    int interface_count = 0;
+    char *lease_path = DEFAULT_LEASE_FILE;
+    struct dhcp_client_config config;
+    dhcp_client_defaults(&config);
+
+    int option;
+    while ((option = getopt(argc, argv, "i:t:f:w:s:T:")) != -1) {
+        int valid = 1;
+        if (option == 'i') {
+            valid = interface_count < MAX_INTERFACES;
+            if (valid) interface_names[interface_count++] = optarg;
         }
-
-        result = OK;
-        for (int x = 0; x < HLEN; x++) {
-            if (packet.chaddr[x] != random_mac[x]) {
-                result = ERROR;
-                break;
-            }
+        else if (option == 't') valid = (config.deadline = atol(optarg) * 1000) > 0;
+        else if (option == 'f') lease_path = optarg;
+        else if (option == 'w') valid = (config.offer_window = atol(optarg)) >= 0;
+        else if (option == 's') {
+            valid = config.trusted_count < MAX_TRUSTED_SERVERS &&
+                    inet_aton(optarg, &config.trusted_servers[config.trusted_count]);
+            config.trusted_count++;
         }
+        else if (option == 'T') {
+            config.trace = strcmp(optarg, "-") == 0 ? stdout : fopen(optarg, "a");
+            valid = config.trace != NULL;
+        }
+        else valid = 0;
+        if (!valid) usage(argv[0]);
+    }
+    if (interface_count == 0) interface_names[interface_count++] = DEFAULT_INTERFACE;
 
-        if (result == ERROR) continue;
-
+    /* the time alone would give every client booted in the same second the same jitter */
+    struct timespec seed;
+    clock_gettime(CLOCK_REALTIME, &seed);
+    srand((unsigned int) (seed.tv_sec ^ seed.tv_nsec ^ getpid()));
 
-        if (type == DHCP_OFFER) {
-	    printf("Offered Address:    %s\n", inet_ntoa(packet.yiaddr));
-            offered_address = packet.yiaddr;
-            send_DHCP_request_packet(sock, source.sin_addr);
-        } else if (type == DHCP_ACK) {
-            int i = 4;
-            while (i < MAX_OPTIONS_LENGTH && packet.options[i] != 3 && packet.options[i] != '\xFF') {
-                i++;
-                int skip = (int) packet.options[i++];
-                while (skip--) i++;
-            }
-            if (packet.options[i] == '\xFF') return OK;
+    printf("Client Starting\n");
 
-            default_gateway.s_addr |= ((int) packet.options[i + 2] & 0x000000FF);
-            default_gateway.s_addr |= ((int) packet.options[i + 3] & 0x000000FF) << 8;
-            default_gateway.s_addr |= ((int) packet.options[i + 4] & 0x000000FF) << 16;
-            default_gateway.s_addr |= ((int) packet.options[i + 5] & 0x000000FF) << 24;
+    int epoll_fd = epoll_create1(0);
+    if (epoll_fd < 0) {
+        printf("Could not create epoll instance\n");
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 0; i < interface_count; i++) {
+        char path[256];
+        if (interface_count == 1) snprintf(path, sizeof(path), "%s", lease_path);
+        else snprintf(path, sizeof(path), "%s.%s", lease_path, interface_names[i]);
+
+        struct dhcp_client *client = dhcp_client_open(interface_names[i], path, &config, report_event, NULL);
+        if (client == NULL) exit(EXIT_FAILURE);
+        struct epoll_event event = {.events = EPOLLIN, .data.ptr = client};
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, dhcp_client_fd(client), &event) < 0) {
+            printf("Could not watch the socket of %s\n", interface_names[i]);
+            exit(EXIT_FAILURE);
         }
-
-        return OK;
+        clients[client_count++] = client;
     }
-    return ERROR;
-}
 
-int send_normal_packet(int sock, char *s) {
-    struct sockaddr_in default_address = get_address(547, default_gateway.s_addr);
-    while (send_packet(s, MAX_MSG_LENGTH, sock, &default_address) == ERROR) {
-        printf("Error in sending packet... resending the packet\n");
+    /* all interfaces acquire at once, so bring-up takes about one exchange however many there are */
+    long now = now_ms();
+    for (int i = 0; i < client_count; i++) {
+        dhcp_client_start(clients[i], now);
     }
-    return OK;
-}
-
-int main() {
-    char interface_name[8] = "enp0s3";
-
-    srand(time(NULL));
-
-    printf("Client Starting\n");
-
-    int sock = create_DHCP_socket(interface_name);
-    make_random_hardware_address();
-    send_DHCP_discover_packet(sock);
     fflush(stdout);
+    while (!all_settled()) {
+        poll_clients(epoll_fd);
+    }
+    started = 1;
 
+    struct dhcp_client *client = message_client();
+    struct in_addr default_gateway = {0};
+    if (client) default_gateway = dhcp_client_lease(client)->router;
     printf("Default Gateway is: %s\n", inet_ntoa(default_gateway));
 
-    for (int i = 0; i < 5; i++) {
-        size_t len = MAX_MSG_LENGTH;
-        char *s = (char*)malloc(len);
-        printf("Enter message: ");
-        fflush(stdout);
-        getline(&s, &len, stdin);
-        send_normal_packet(sock, s);
-        free(s);
+    if (client) run_messages(epoll_fd);
+    for (int i = 0; i < client_count; i++) {
+        dhcp_client_close(clients[i]);
     }
-    close(sock);
+    close(epoll_fd);
+    if (config.trace && config.trace != stdout) fclose(config.trace);
 
     return 0;
 }
@@ -0,0 +1,768 @@
+#include "dhcp_client.h"
+
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/dhcp.h"
+
+#define OK 0
+#define ERROR -1
+
+#define SERVER_PORT 66
+
+/* RFC 2131 4.1: wait 4 s, doubling up to 64 s, each randomized by +-1 s */
+#define RETRANSMIT_INITIAL 4000
+#define RETRANSMIT_MAX     64000
+#define RETRANSMIT_JITTER  1000
+#define REBOOT_TIMEOUT     8000    /* ms to wait for the ACK of a cached lease before discovering */
+#define REQUEST_ATTEMPTS   3       /* RFC 2131 4.4.1: REQUESTs of a chosen OFFER sent before discovering again */
+#define RENEW_MIN_WAIT     60000   /* RFC 2131 4.4.5: retransmit RENEWING and REBINDING no faster than this */
+#define DEFAULT_LEASE_TIME 3600    /* s, for an ACK without a usable option 51 */
+
+#define DEFAULT_DEADLINE     60000
+#define DEFAULT_OFFER_WINDOW 500
+
+#define MAX_LEASE_PATH 256
+#define MAX_TRACE_EVENTS 32
+
+enum trace_kind {
+    TRACE_DISCOVER,
+    TRACE_REBOOT,
+    TRACE_OFFER,
+    TRACE_REQUEST,
+    TRACE_RETRANSMIT,
+    TRACE_RENEW,
+    TRACE_REBIND,
+    TRACE_ACK,
+    TRACE_NAK,
+    TRACE_FAILED
+};
+
+static const char *trace_names[] = {"discover", "reboot", "offer", "request", "retransmit", "renew", "rebind",
+                                    "ack", "nak", "failed"};
+
+/* Recorded in memory while an exchange runs and written out once it settles. */
+struct trace_event {
+    enum trace_kind kind;
+    int attempt;
+    long time;                        /* monotonic us */
+    u_int32_t transaction_id;
+    struct in_addr address;
+    struct in_addr server;
+};
+
+/* option layout of DISCOVER */
+enum discover_layout {
+    DISCOVER_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    DISCOVER_END = DISCOVER_MESSAGE_TYPE + DHCP_OPTION_SIZE(1)
+};
+DHCP_CHECK_LAYOUT(DISCOVER_END + 1);
+
+/* option layout of REQUEST */
+enum request_layout {
+    REQUEST_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    REQUEST_ADDRESS = REQUEST_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    REQUEST_SERVER_ID = REQUEST_ADDRESS + DHCP_OPTION_SIZE(4),
+    REQUEST_END = REQUEST_SERVER_ID + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(REQUEST_END + 1);
+
+/* option layout of an INIT-REBOOT REQUEST, which names no server */
+enum reboot_layout {
+    REBOOT_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    REBOOT_ADDRESS = REBOOT_MESSAGE_TYPE + DHCP_OPTION_SIZE(1),
+    REBOOT_END = REBOOT_ADDRESS + DHCP_OPTION_SIZE(4)
+};
+DHCP_CHECK_LAYOUT(REBOOT_END + 1);
+
+/* option layout of a RENEWING or REBINDING REQUEST, the address goes in ciaddr */
+enum renew_layout {
+    RENEW_MESSAGE_TYPE = DHCP_COOKIE_LENGTH,
+    RENEW_END = RENEW_MESSAGE_TYPE + DHCP_OPTION_SIZE(1)
+};
+DHCP_CHECK_LAYOUT(RENEW_END + 1);
+
+struct dhcp_client {
+    char interface_name[IFNAMSIZ];
+    char lease_path[MAX_LEASE_PATH];
+    int sock;
+    const struct dhcp_client_config *config;
+    dhcp_client_callback callback;
+    void *context;
+
+    enum dhcp_client_state state;
+    unsigned char hardware_address[HLEN];
+    struct dhcp_lease lease;          /* while acquiring, the address and server being asked for */
+    u_int32_t transaction_id;
+
+    DHCP_packet request;              /* the last packet sent, kept for retransmission */
+    int request_length;
+    struct sockaddr_in destination;
+    long sent_at;
+    long retransmit_at;
+    long retransmit_timeout;          /* current backoff while acquiring */
+    long acquire_start;               /* for the secs field */
+    long deadline;                    /* end of the acquisition */
+    long give_up;                     /* REBOOTING: when to fall back to DISCOVER */
+
+    int have_offer;                   /* SELECTING: the best OFFER so far */
+    DHCP_packet offer;
+    struct in_addr offer_server;
+    int offer_rank;
+    long window_end;
+
+    long renew_at, rebind_at, expire_at;
+
+    int attempt;                      /* transmissions of the current packet */
+    struct trace_event trace[MAX_TRACE_EVENTS];
+    int trace_count;
+    long trace_start;                 /* us, first event of the exchange being traced, 0 between exchanges */
+};
+
+static struct sockaddr_in get_address(in_port_t port, in_addr_t ip) {
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = ip;
+    return address;
+}
+
+static int create_DHCP_socket(const char *interface_name) {
+    int sock = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP);
+    if (sock < 0) {
+        printf("Could not create socket\n");
+        return ERROR;
+    }
+
+    /* one socket per interface, all bound to the client port */
+    int opt_val = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &opt_val, sizeof(opt_val)) < 0 ||
+        setsockopt(sock, SOL_SOCKET, SO_BROADCAST, &opt_val, sizeof(opt_val)) < 0) {
+        printf("Could not set socket options on DHCP socket!\n");
+        close(sock);
+        return ERROR;
+    }
+    if (setsockopt(sock, SOL_SOCKET, SO_BINDTODEVICE, interface_name, strlen(interface_name) + 1) < 0) {
+        printf("\tCould not bind socket to interface %s. Check your privileges...\n", interface_name);
+        close(sock);
+        return ERROR;
+    }
+    struct sockaddr_in client_address = get_address(CLIENT_PORT, INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &client_address, sizeof(client_address)) < 0) {
+        printf("\tCould not bind to DHCP socket (port %d)! Check your privileges...\n", CLIENT_PORT);
+        close(sock);
+        return ERROR;
+    }
+    return sock;
+}
+
+/*
+ * Per-phase timing, for telling a slow network from a slow server. Events
+ * only go into a fixed array on the way through the exchange; the JSON lines
+ * are formatted and written when it is over, so tracing costs the exchange
+ * a clock read per event:
+ *   {"interface":"enp0s3","xid":"0x1a2b3c4d","event":"offer","t_us":412,"attempt":1,
+ *    "address":"10.0.2.120","server":"10.0.2.15"}
+ * t_us counts from the first event of the exchange, also for the events
+ * written early because the array filled up.
+ */
+static void trace_write(struct dhcp_client *client) {
+    FILE *trace = client->config->trace;
+    if (trace == NULL || client->trace_count == 0) return;
+
+    long start = client->trace_start;
+    for (int i = 0; i < client->trace_count; i++) {
+        const struct trace_event *event = &client->trace[i];
+        fprintf(trace, "{\"interface\":\"%s\",\"xid\":\"0x%08x\",\"event\":\"%s\",\"t_us\":%ld,\"attempt\":%d",
+                client->interface_name, event->transaction_id, trace_names[event->kind], event->time - start,
+                event->attempt);
+        if (event->address.s_addr) fprintf(trace, ",\"address\":\"%s\"", inet_ntoa(event->address));
+        if (event->server.s_addr) fprintf(trace, ",\"server\":\"%s\"", inet_ntoa(event->server));
+        fprintf(trace, "}\n");
+    }
+    fflush(trace);
+    client->trace_count = 0;
+}
+
+/* Write out the exchange that just settled, the next event starts a new one. */
+static void trace_flush(struct dhcp_client *client) {
+    trace_write(client);
+    client->trace_start = 0;
+}
+
+static void trace_event(struct dhcp_client *client, enum trace_kind kind, struct in_addr address,
+                        struct in_addr server) {
+    if (client->config->trace == NULL) return;
+    if (client->trace_count == MAX_TRACE_EVENTS) trace_write(client);
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct trace_event *event = &client->trace[client->trace_count++];
+    event->kind = kind;
+    event->attempt = client->attempt;
+    event->time = now.tv_sec * 1000000L + now.tv_nsec / 1000;
+    if (client->trace_start == 0) client->trace_start = event->time;
+    event->transaction_id = client->transaction_id;
+    event->address = address;
+    event->server = server;
+}
+
+static void notify(struct dhcp_client *client, enum dhcp_client_event event) {
+    if (client->callback) client->callback(client, event, client->context);
+}
+
+static void make_random_hardware_address(struct dhcp_client *client) {
+    unsigned char *mac = client->hardware_address;
+    for (int i = 0; i < HLEN; i++) {
+        mac[i] = rand() % 0x100;
+    }
+    mac[0] = (mac[0] & ~0x01) | 0x02;    /* unicast, locally administered */
+    printf("%s: Random MAC Address: %02x:%02x:%02x:%02x:%02x:%02x\n", client->interface_name, mac[0], mac[1],
+           mac[2], mac[3], mac[4], mac[5]);
+}
+
+/*
+ * The lease file keeps the hardware address across runs, so the server sees
+ * the same client, and the last lease, so the client can ask for it back:
+ *   mac aa:bb:cc:dd:ee:ff
+ *   address 10.0.2.120
+ *   server 10.0.2.15
+ *   router 10.0.2.15
+ *   expiry 1791234567
+ * ERROR if there is no file or no usable hardware address in it.
+ */
+static int load_lease(struct dhcp_client *client) {
+    FILE *file = fopen(client->lease_path, "r");
+    if (file == NULL) return ERROR;
+
+    unsigned char *mac = client->hardware_address;
+    int result = ERROR;
+    char key[16], value[32];
+    while (fscanf(file, "%15s %31s", key, value) == 2) {
+        if (strcmp(key, "mac") == 0) {
+            result = sscanf(value, "%hhx:%hhx:%hhx:%hhx:%hhx:%hhx", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4],
+                            &mac[5]) == HLEN ? OK : ERROR;
+        }
+        else if (strcmp(key, "address") == 0) inet_aton(value, &client->lease.address);
+        else if (strcmp(key, "server") == 0) inet_aton(value, &client->lease.server);
+        else if (strcmp(key, "router") == 0) inet_aton(value, &client->lease.router);
+        else if (strcmp(key, "expiry") == 0) client->lease.expiry = strtoul(value, NULL, 10);
+    }
+    fclose(file);
+    return result;
+}
+
+/* Write the file next to the old one and rename it over, so a crash never leaves half a lease. */
+static int save_lease(struct dhcp_client *client) {
+    char temporary[MAX_LEASE_PATH + 4];
+    snprintf(temporary, sizeof(temporary), "%s.tmp", client->lease_path);
+    FILE *file = fopen(temporary, "w");
+    if (file == NULL) return ERROR;
+
+    const unsigned char *mac = client->hardware_address;
+    fprintf(file, "mac %02x:%02x:%02x:%02x:%02x:%02x\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
+    fprintf(file, "address %s\n", inet_ntoa(client->lease.address));
+    fprintf(file, "server %s\n", inet_ntoa(client->lease.server));
+    fprintf(file, "router %s\n", inet_ntoa(client->lease.router));
+    fprintf(file, "expiry %u\n", client->lease.expiry);
+    if (fclose(file) != 0 || rename(temporary, client->lease_path) != 0) {
+        unlink(temporary);
+        return ERROR;
+    }
+    return OK;
+}
+
+static void forget_lease(struct dhcp_client *client) {
+    memset(&client->lease, 0, sizeof(client->lease));
+    save_lease(client);
+}
+
+/*
+ * Preference of a server by its id (option 54): its place in the trusted
+ * list, ERROR if there is a list and it is not on it, MAX_TRUSTED_SERVERS
+ * (all equal) without a list.
+ */
+static int server_rank(const struct dhcp_client_config *config, struct in_addr server_id) {
+    if (config->trusted_count == 0) return MAX_TRUSTED_SERVERS;
+    for (int i = 0; i < config->trusted_count; i++) {
+        if (config->trusted_servers[i].s_addr == server_id.s_addr) return i;
+    }
+    return ERROR;
+}
+
+/* Server id of a reply, taken from option 54 or failing that the sender. */
+static struct in_addr reply_server(const DHCP_packet *packet, const struct sockaddr_in *source) {
+    struct in_addr server_id;
+    if (dhcp_get_address(packet, OPTION_SERVER_ID, &server_id) == ERROR) server_id = source->sin_addr;
+    return server_id;
+}
+
+/*
+ * OK if packet is a reply of the given type (or a NAK when waiting for an
+ * ACK) to the current transaction from a server we may take it from. After
+ * SELECTING, only the chosen server's answer counts.
+ */
+static int match_DHCP_reply(struct dhcp_client *client, const DHCP_packet *packet, int type) {
+    if (packet->op != BOOT_REPLY) return ERROR;
+    if (ntohl(packet->xid) != client->transaction_id) return ERROR;
+    if (memcmp(packet->chaddr, client->hardware_address, HLEN) != 0) return ERROR;
+
+    int message_type = dhcp_message_type(packet);
+    if (message_type != type && !(type == DHCP_ACK && message_type == DHCP_NACK)) return ERROR;
+
+    struct in_addr server_id = {0};
+    int has_server_id = dhcp_get_address(packet, OPTION_SERVER_ID, &server_id) == OK;
+    if (client->config->trusted_count && (!has_server_id || server_rank(client->config, server_id) == ERROR)) {
+        printf("%s: Ignoring reply from untrusted server %s\n", client->interface_name, inet_ntoa(server_id));
+        return ERROR;
+    }
+    if (client->state == CLIENT_REQUESTING && has_server_id && server_id.s_addr != client->lease.server.s_addr) {
+        printf("%s: Ignoring reply from %s, not the selected server\n", client->interface_name,
+               inet_ntoa(server_id));
+        return ERROR;
+    }
+    return OK;
+}
+
+/* Fixed fields of a request in the current transaction. */
+static void begin_packet(struct dhcp_client *client, DHCP_packet *packet) {
+    memset(packet, 0, sizeof(*packet));
+    packet->op = BOOT_REQUEST;
+    packet->htype = HTYPE;
+    packet->hlen = HLEN;
+    packet->xid = htonl(client->transaction_id);
+    memcpy(packet->chaddr, client->hardware_address, HLEN);
+    set_magic_cookie(packet);
+}
+
+static void transmit(struct dhcp_client *client, long now) {
+    client->request.secs = htons((u_int16_t) ((now - client->acquire_start) / 1000));
+    if (sendto(client->sock, &client->request, client->request_length, 0, (struct sockaddr *) &client->destination,
+               sizeof(client->destination)) < 0) {
+        printf("%s: Error in sending packet\n", client->interface_name);
+    }
+    client->sent_at = now;
+    client->attempt++;
+}
+
+/*
+ * While acquiring, the wait doubles after every attempt and is randomized so
+ * that clients booting together do not retransmit in step.
+ */
+static void schedule_retransmit(struct dhcp_client *client, long now) {
+    client->retransmit_at = now + client->retransmit_timeout + rand() % (2 * RETRANSMIT_JITTER + 1) -
+                            RETRANSMIT_JITTER;
+    client->retransmit_timeout *= 2;
+    if (client->retransmit_timeout > RETRANSMIT_MAX) client->retransmit_timeout = RETRANSMIT_MAX;
+}
+
+/* Broadcast the request just built and start its backoff. */
+static void broadcast_request(struct dhcp_client *client, int length, long now) {
+    client->request_length = length;
+    client->destination = get_address(SERVER_PORT, INADDR_BROADCAST);
+    client->retransmit_timeout = RETRANSMIT_INITIAL;
+    client->attempt = 0;
+    transmit(client, now);
+    schedule_retransmit(client, now);
+}
+
+static void send_DHCP_discover_packet(struct dhcp_client *client, long now) {
+    client->state = CLIENT_SELECTING;
+    client->have_offer = 0;
+    client->transaction_id = rand();
+
+    DHCP_packet *packet = &client->request;
+    begin_packet(client, packet);
+    packet->flags = htons(BROADCAST_FLAG);
+    dhcp_put_u8(packet, DISCOVER_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_DISCOVER);
+    broadcast_request(client, (int) dhcp_finish(packet, DISCOVER_END), now);
+    trace_event(client, TRACE_DISCOVER, (struct in_addr) {0}, (struct in_addr) {0});
+}
+
+/* REQUEST the chosen OFFER in the same transaction. */
+static void send_DHCP_request_packet(struct dhcp_client *client, long now) {
+    client->state = CLIENT_REQUESTING;
+
+    DHCP_packet *packet = &client->request;
+    begin_packet(client, packet);
+    packet->flags = htons(BROADCAST_FLAG);
+    dhcp_put_u8(packet, REQUEST_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_REQUEST);
+    dhcp_put_address(packet, REQUEST_ADDRESS, OPTION_ADDRESS_REQUEST, client->lease.address);
+    dhcp_put_address(packet, REQUEST_SERVER_ID, OPTION_SERVER_ID, client->lease.server);
+    printf("%s: Requesting Address: %s\n", client->interface_name, inet_ntoa(client->lease.address));
+    broadcast_request(client, (int) dhcp_finish(packet, REQUEST_END), now);
+    trace_event(client, TRACE_REQUEST, client->lease.address, client->lease.server);
+}
+
+/* RFC 2131 3.2 INIT-REBOOT: ask for the cached address back with a broadcast REQUEST. */
+static void send_DHCP_reboot_packet(struct dhcp_client *client, long now) {
+    client->state = CLIENT_REBOOTING;
+    client->transaction_id = rand();
+    client->give_up = now + REBOOT_TIMEOUT;
+
+    DHCP_packet *packet = &client->request;
+    begin_packet(client, packet);
+    packet->flags = htons(BROADCAST_FLAG);
+    dhcp_put_u8(packet, REBOOT_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_REQUEST);
+    dhcp_put_address(packet, REBOOT_ADDRESS, OPTION_ADDRESS_REQUEST, client->lease.address);
+    printf("%s: Rebooting with Address: %s\n", client->interface_name, inet_ntoa(client->lease.address));
+    broadcast_request(client, (int) dhcp_finish(packet, REBOOT_END), now);
+    trace_event(client, TRACE_REBOOT, client->lease.address, (struct in_addr) {0});
+}
+
+/* Whether address is configured on the interface, so that an ACK unicast to it can reach us. */
+static int address_configured(const char *interface_name, struct in_addr address) {
+    struct ifaddrs *addresses;
+    if (getifaddrs(&addresses) < 0) return 0;
+    int found = 0;
+    for (struct ifaddrs *entry = addresses; entry && !found; entry = entry->ifa_next) {
+        found = entry->ifa_addr && entry->ifa_addr->sa_family == AF_INET &&
+                strcmp(entry->ifa_name, interface_name) == 0 &&
+                ((struct sockaddr_in *) entry->ifa_addr)->sin_addr.s_addr == address.s_addr;
+    }
+    freeifaddrs(addresses);
+    return found;
+}
+
+/*
+ * Ask to extend the lease: by unicast to the server that granted it while
+ * RENEWING, by broadcast to any server while REBINDING. The server answers at
+ * ciaddr, which only arrives if the leased address is configured here; this
+ * client leaves addressing to the caller, so until it is the REQUEST asks for
+ * a broadcast ACK instead. Retransmissions wait half the time left to the
+ * next step, but no less than RENEW_MIN_WAIT.
+ */
+static void send_DHCP_renew_packet(struct dhcp_client *client, long now) {
+    DHCP_packet *packet = &client->request;
+    begin_packet(client, packet);
+    packet->ciaddr = client->lease.address;
+    if (!address_configured(client->interface_name, client->lease.address)) packet->flags = htons(BROADCAST_FLAG);
+    dhcp_put_u8(packet, RENEW_MESSAGE_TYPE, OPTION_MESSAGE_TYPE, DHCP_REQUEST);
+    client->request_length = (int) dhcp_finish(packet, RENEW_END);
+
+    int renewing = client->state == CLIENT_RENEWING;
+    client->destination = renewing ? get_address(SERVER_PORT, client->lease.server.s_addr)
+                                   : get_address(SERVER_PORT, INADDR_BROADCAST);
+    printf("%s: %s lease of %s\n", client->interface_name, renewing ? "Renewing" : "Rebinding",
+           inet_ntoa(client->lease.address));
+    transmit(client, now);
+    trace_event(client, renewing ? TRACE_RENEW : TRACE_REBIND, client->lease.address,
+                renewing ? client->lease.server : (struct in_addr) {0});
+
+    long wait = ((renewing ? client->rebind_at : client->expire_at) - now) / 2;
+    client->retransmit_at = now + (wait > RENEW_MIN_WAIT ? wait : RENEW_MIN_WAIT);
+}
+
+/* INIT-REBOOT with a still valid cached lease, otherwise DISCOVER, until the deadline. */
+static void acquire_lease(struct dhcp_client *client, long now) {
+    client->acquire_start = now;
+    client->deadline = now + client->config->deadline;
+    if (client->lease.address.s_addr && client->lease.expiry > time(NULL)) send_DHCP_reboot_packet(client, now);
+    else send_DHCP_discover_packet(client, now);
+}
+
+static void fail(struct dhcp_client *client) {
+    client->state = CLIENT_FAILED;
+    printf("%s: No lease after %ld s\n", client->interface_name, client->config->deadline / 1000);
+    trace_event(client, TRACE_FAILED, client->lease.address, client->lease.server);
+    notify(client, DHCP_CLIENT_FAILED);
+    trace_flush(client);
+}
+
+static void lose_lease(struct dhcp_client *client, long now) {
+    forget_lease(client);
+    notify(client, DHCP_CLIENT_EXPIRED);
+    acquire_lease(client, now);
+}
+
+/*
+ * Take the lease an ACK grants, remember it and set its timers: T1 and T2
+ * from options 58 and 59, by default at 1/2 and 7/8 of the lease (RFC 2131 4.4.5).
+ * An ACK without a lease time gets DEFAULT_LEASE_TIME rather than one that
+ * expires at once, and T1 and T2 that do not satisfy T1 < T2 < lease fall
+ * back to the defaults. The timers are kept in milliseconds so that short
+ * leases still renew before they rebind.
+ */
+static void accept_DHCP_ack(struct dhcp_client *client, const DHCP_packet *ack, const struct sockaddr_in *source,
+                            long now) {
+    int renewal = client->state == CLIENT_RENEWING || client->state == CLIENT_REBINDING;
+    u_int32_t lease_time = 0;
+    dhcp_get_u32(ack, OPTION_LEASE_TIME, &lease_time);
+    if (lease_time == 0) {
+        printf("%s: The ACK carries no lease time, assuming %d s\n", client->interface_name, DEFAULT_LEASE_TIME);
+        lease_time = DEFAULT_LEASE_TIME;
+    }
+    client->lease.address = ack->yiaddr;
+    client->lease.server = reply_server(ack, source);
+    dhcp_get_address(ack, OPTION_DEFAULT_GATEWAY_ROUTER_ID, &client->lease.router);
+    client->lease.expiry = (u_int32_t) time(NULL) + lease_time;
+
+    u_int32_t renewal_time = 0, rebinding_time = 0;
+    dhcp_get_u32(ack, OPTION_RENEWAL_TIME, &renewal_time);
+    dhcp_get_u32(ack, OPTION_REBINDING_TIME, &rebinding_time);
+    long lease_ms = lease_time * 1000L, renew_ms = renewal_time * 1000L, rebind_ms = rebinding_time * 1000L;
+    if (renew_ms <= 0 || renew_ms >= rebind_ms || rebind_ms >= lease_ms) {
+        renew_ms = lease_ms / 2;
+        rebind_ms = lease_ms / 8 * 7;
+    }
+    client->state = CLIENT_BOUND;
+    client->renew_at = now + renew_ms;
+    client->rebind_at = now + rebind_ms;
+    client->expire_at = now + lease_ms;
+
+    if (save_lease(client) == ERROR) printf("%s: Could not save the lease to %s\n", client->interface_name,
+                                            client->lease_path);
+    if (renewal) {
+        printf("%s: Lease of %s extended, next renewal in %.1f s\n", client->interface_name,
+               inet_ntoa(client->lease.address), renew_ms / 1000.0);
+    }
+    trace_event(client, TRACE_ACK, client->lease.address, client->lease.server);
+    notify(client, renewal ? DHCP_CLIENT_RENEWED : DHCP_CLIENT_BOUND);
+    trace_flush(client);
+}
+
+static void select_offer(struct dhcp_client *client, long now) {
+    printf("%s: Offered Address:    %s\n", client->interface_name, inet_ntoa(client->offer.yiaddr));
+    client->lease.address = client->offer.yiaddr;
+    client->lease.server = client->offer_server;
+    send_DHCP_request_packet(client, now);
+}
+
+/*
+ * Keep the best OFFER: the lowest trusted list rank, then the lowest server
+ * id, so the same set of offers always gives the same choice. The first one
+ * opens a window of offer_window ms; an OFFER from the first trusted server
+ * ends it at once, so the usual case adds no delay.
+ */
+static void consider_offer(struct dhcp_client *client, const DHCP_packet *offer, const struct sockaddr_in *source,
+                           long now) {
+    struct in_addr server = reply_server(offer, source);
+    int rank = server_rank(client->config, server);
+    trace_event(client, TRACE_OFFER, offer->yiaddr, server);
+    if (!client->have_offer || rank < client->offer_rank ||
+        (rank == client->offer_rank && ntohl(server.s_addr) < ntohl(client->offer_server.s_addr))) {
+        client->offer = *offer;
+        client->offer_server = server;
+        client->offer_rank = rank;
+    }
+    if (!client->have_offer) {
+        client->have_offer = 1;
+        client->window_end = now + client->config->offer_window;
+        if (client->window_end > client->deadline) client->window_end = client->deadline;
+    }
+    if (client->offer_rank == 0 || now >= client->window_end) select_offer(client, now);
+}
+
+static void handle_reply(struct dhcp_client *client, const DHCP_packet *packet, const struct sockaddr_in *source,
+                         long now) {
+    switch (client->state) {
+    case CLIENT_SELECTING:
+        if (match_DHCP_reply(client, packet, DHCP_OFFER) == OK) consider_offer(client, packet, source, now);
+        break;
+    case CLIENT_REBOOTING:
+    case CLIENT_REQUESTING:
+    case CLIENT_RENEWING:
+    case CLIENT_REBINDING:
+        if (match_DHCP_reply(client, packet, DHCP_ACK) == ERROR) break;
+        if (dhcp_message_type(packet) == DHCP_ACK) {
+            accept_DHCP_ack(client, packet, source, now);
+            break;
+        }
+        trace_event(client, TRACE_NAK, client->lease.address, reply_server(packet, source));
+        if (client->state == CLIENT_REBOOTING) {
+            printf("%s: Cached lease refused, discovering\n", client->interface_name);
+            forget_lease(client);
+            send_DHCP_discover_packet(client, now);
+        }
+        else {
+            printf("%s: Lease of %s refused\n", client->interface_name, inet_ntoa(client->lease.address));
+            lose_lease(client, now);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+/*
+ * Acquisition timers: the offer window, retransmission, the INIT-REBOOT and
+ * REQUESTING fallbacks to DISCOVER and the deadline.
+ */
+static void run_acquire_timers(struct dhcp_client *client, long now) {
+    if (client->state == CLIENT_SELECTING && client->have_offer && now >= client->window_end) {
+        select_offer(client, now);
+        return;
+    }
+    if (now >= client->deadline) {
+        fail(client);
+        return;
+    }
+    if (client->state == CLIENT_REBOOTING && now >= client->give_up) {
+        printf("%s: No answer for the cached lease, discovering\n", client->interface_name);
+        send_DHCP_discover_packet(client, now);
+        return;
+    }
+    if (client->state == CLIENT_REQUESTING && client->attempt >= REQUEST_ATTEMPTS && now >= client->retransmit_at) {
+        printf("%s: No answer to %d requests for %s, discovering\n", client->interface_name, client->attempt,
+               inet_ntoa(client->lease.address));
+        send_DHCP_discover_packet(client, now);
+        return;
+    }
+    if (now >= client->retransmit_at) {
+        printf("%s: No reply after %ld ms, retransmitting\n", client->interface_name, now - client->sent_at);
+        transmit(client, now);
+        struct in_addr none = {0};
+        int selecting = client->state == CLIENT_SELECTING;
+        trace_event(client, TRACE_RETRANSMIT, selecting ? none : client->lease.address,
+                    selecting ? none : client->lease.server);
+        schedule_retransmit(client, now);
+    }
+}
+
+/* Lease timers: RENEWING at T1, REBINDING at T2, starting over when the lease ends. */
+static void run_lease_timers(struct dhcp_client *client, long now) {
+    if (now >= client->expire_at) {
+        printf("%s: Lease of %s expired\n", client->interface_name, inet_ntoa(client->lease.address));
+        lose_lease(client, now);
+    }
+    else if (client->state == CLIENT_BOUND && now >= client->renew_at) {
+        client->state = CLIENT_RENEWING;
+        client->transaction_id = rand();
+        send_DHCP_renew_packet(client, now);
+    }
+    else if (client->state == CLIENT_RENEWING && now >= client->rebind_at) {
+        client->state = CLIENT_REBINDING;
+        send_DHCP_renew_packet(client, now);
+    }
+    else if (client->state != CLIENT_BOUND && now >= client->retransmit_at) {
+        send_DHCP_renew_packet(client, now);
+    }
+}
+
+void dhcp_client_defaults(struct dhcp_client_config *config) {
+    memset(config, 0, sizeof(*config));
+    config->deadline = DEFAULT_DEADLINE;
+    config->offer_window = DEFAULT_OFFER_WINDOW;
+}
+
+struct dhcp_client *dhcp_client_open(const char *interface_name, const char *lease_path,
+                                     const struct dhcp_client_config *config, dhcp_client_callback callback,
+                                     void *context) {
+    if (strlen(interface_name) >= IFNAMSIZ || strlen(lease_path) >= MAX_LEASE_PATH) return NULL;
+    struct dhcp_client *client = calloc(1, sizeof(*client));
+    if (client == NULL) return NULL;
+
+    strcpy(client->interface_name, interface_name);
+    strcpy(client->lease_path, lease_path);
+    client->config = config;
+    client->callback = callback;
+    client->context = context;
+    client->state = CLIENT_FAILED;
+
+    client->sock = create_DHCP_socket(interface_name);
+    if (client->sock == ERROR) {
+        free(client);
+        return NULL;
+    }
+
+    if (load_lease(client) == ERROR) {
+        make_random_hardware_address(client);
+        forget_lease(client);
+    }
+    else {
+        const unsigned char *mac = client->hardware_address;
+        printf("%s: MAC Address: %02x:%02x:%02x:%02x:%02x:%02x\n", interface_name, mac[0], mac[1], mac[2], mac[3],
+               mac[4], mac[5]);
+    }
+    return client;
+}
+
+void dhcp_client_close(struct dhcp_client *client) {
+    if (client == NULL) return;
+    close(client->sock);
+    free(client);
+}
+
+void dhcp_client_start(struct dhcp_client *client, long now) {
+    acquire_lease(client, now);
+}
+
+int dhcp_client_fd(const struct dhcp_client *client) {
+    return client->sock;
+}
+
+void dhcp_client_input(struct dhcp_client *client, long now) {
+    while (1) {
+        DHCP_packet packet;
+        struct sockaddr_in source;
+        socklen_t address_size = sizeof(source);
+        memset(&source, 0, sizeof(source));
+        ssize_t received = recvfrom(client->sock, &packet, sizeof(packet), 0, (struct sockaddr *) &source,
+                                    &address_size);
+        if (received < 0) return;
+
+        memset((char *) &packet + received, 0, sizeof(packet) - received);
+        handle_reply(client, &packet, &source, now);
+    }
+}
+
+void dhcp_client_timer(struct dhcp_client *client, long now) {
+    switch (client->state) {
+    case CLIENT_REBOOTING:
+    case CLIENT_SELECTING:
+    case CLIENT_REQUESTING:
+        run_acquire_timers(client, now);
+        break;
+    case CLIENT_BOUND:
+    case CLIENT_RENEWING:
+    case CLIENT_REBINDING:
+        run_lease_timers(client, now);
+        break;
+    case CLIENT_FAILED:
+        break;
+    }
+}
+
+static long earliest(long a, long b) {
+    return a < b ? a : b;
+}
+
+long dhcp_client_next_timer(const struct dhcp_client *client) {
+    switch (client->state) {
+    case CLIENT_REBOOTING:
+        return earliest(earliest(client->retransmit_at, client->give_up), client->deadline);
+    case CLIENT_SELECTING:
+        if (client->have_offer) return earliest(client->window_end, client->deadline);
+        return earliest(client->retransmit_at, client->deadline);
+    case CLIENT_REQUESTING:
+        return earliest(client->retransmit_at, client->deadline);
+    case CLIENT_BOUND:
+        return earliest(client->renew_at, client->expire_at);
+    case CLIENT_RENEWING:
+        return earliest(earliest(client->retransmit_at, client->rebind_at), client->expire_at);
+    case CLIENT_REBINDING:
+        return earliest(client->retransmit_at, client->expire_at);
+    case CLIENT_FAILED:
+        break;
+    }
+    return -1;
+}
+
+enum dhcp_client_state dhcp_client_state(const struct dhcp_client *client) {
+    return client->state;
+}
+
+const struct dhcp_lease *dhcp_client_lease(const struct dhcp_client *client) {
+    return &client->lease;
+}
+
+const char *dhcp_client_interface(const struct dhcp_client *client) {
+    return client->interface_name;
+}
@@ -0,0 +1,93 @@
+#ifndef DHCP_CLIENT_DHCP_CLIENT_H
+#define DHCP_CLIENT_DHCP_CLIENT_H
+
+#include <net/if.h>
+#include <netinet/in.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+#define MAX_TRUSTED_SERVERS 8
+
+/*
+ * Non-blocking DHCP client for one interface. Each client owns its socket
+ * and timers and never waits: the caller watches dhcp_client_fd() for input,
+ * sleeps until dhcp_client_next_timer(), and calls dhcp_client_input() or
+ * dhcp_client_timer() when either is due. Any number of clients can share one
+ * epoll loop, so interfaces acquire their leases in parallel.
+ *
+ * A client keeps its hardware address and last lease in a lease file, starts
+ * with INIT-REBOOT when that lease is still valid and otherwise DISCOVERs,
+ * retransmitting with RFC 2131 backoff until the acquisition deadline. Once
+ * bound it renews at T1, rebinds at T2 and starts over when the lease ends.
+ */
+
+enum dhcp_client_state {
+    CLIENT_REBOOTING,     /* INIT-REBOOT REQUEST for the cached lease sent */
+    CLIENT_SELECTING,     /* DISCOVER sent, collecting OFFERs */
+    CLIENT_REQUESTING,    /* REQUEST for the chosen OFFER sent */
+    CLIENT_BOUND,
+    CLIENT_RENEWING,      /* past T1, asking the server that granted the lease by unicast */
+    CLIENT_REBINDING,     /* past T2, asking any server by broadcast */
+    CLIENT_FAILED         /* no lease by the deadline, nothing more happens */
+};
+
+enum dhcp_client_event {
+    DHCP_CLIENT_BOUND,    /* a new lease, after INIT-REBOOT or DISCOVER */
+    DHCP_CLIENT_RENEWED,
+    DHCP_CLIENT_EXPIRED,  /* the lease ran out or was refused, acquisition starts over */
+    DHCP_CLIENT_FAILED
+};
+
+struct dhcp_client_config {
+    long deadline;                    /* ms to acquire a lease */
+    long offer_window;                /* ms to keep collecting OFFERs after the first one */
+    struct in_addr trusted_servers[MAX_TRUSTED_SERVERS];   /* empty: any server, else in preference order */
+    int trusted_count;
+    FILE *trace;                      /* JSON lines of every exchange's phases, NULL for none */
+};
+
+struct dhcp_lease {
+    struct in_addr address;
+    struct in_addr server;
+    struct in_addr router;
+    u_int32_t expiry;                 /* wall clock seconds, 0 without a lease */
+};
+
+struct dhcp_client;
+
+typedef void (*dhcp_client_callback)(struct dhcp_client *client, enum dhcp_client_event event, void *context);
+
+/* Fill config with the defaults. */
+void dhcp_client_defaults(struct dhcp_client_config *config);
+
+/*
+ * Open the socket on interface_name and load lease_path, drawing a new
+ * hardware address if the file has none. config must outlive the client.
+ * NULL if the socket cannot be set up.
+ */
+struct dhcp_client *dhcp_client_open(const char *interface_name, const char *lease_path,
+                                     const struct dhcp_client_config *config, dhcp_client_callback callback,
+                                     void *context);
+
+void dhcp_client_close(struct dhcp_client *client);
+
+/* Begin acquiring a lease. now is on the monotonic clock in ms, like every time below. */
+void dhcp_client_start(struct dhcp_client *client, long now);
+
+/* The socket to watch for input. */
+int dhcp_client_fd(const struct dhcp_client *client);
+
+/* Read everything pending on the socket. */
+void dhcp_client_input(struct dhcp_client *client, long now);
+
+/* Run whatever timers are due. */
+void dhcp_client_timer(struct dhcp_client *client, long now);
+
+/* When dhcp_client_timer() should next run, -1 if never. */
+long dhcp_client_next_timer(const struct dhcp_client *client);
+
+enum dhcp_client_state dhcp_client_state(const struct dhcp_client *client);
+const struct dhcp_lease *dhcp_client_lease(const struct dhcp_client *client);
+const char *dhcp_client_interface(const struct dhcp_client *client);
+
+#endif
@@ -1,2 +1,2 @@
-gcc -o client client.c
+gcc -o client client.c dhcp_client.c
 sudo ./client
@@ -0,0 +1,183 @@
+#ifndef DHCP_COMMON_DHCP_H
+#define DHCP_COMMON_DHCP_H
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/types.h>
+
+/*
+ * DHCP packet layout and option codec shared by the server, the client and the
+ * attack tools. Options are written through typed encoders at offsets that the
+ * caller declares as an enum, each one derived from the previous option's
+ * size, so the compiler computes the layout and offsets cannot drift. Nothing
+ * here allocates; a packet is encoded in place and sent at its encoded length.
+ */
+
+#define MAX_CHADDR_LENGTH  16
+#define MAX_SNAME_LENGTH   64
+#define MAX_FILE_LENGTH    128
+#define MAX_OPTIONS_LENGTH 312
+
+struct DHCP_packet {
+    u_int8_t op;                             /* packet type */
+    u_int8_t htype;                          /* type of hardware address for this machine (Ethernet, etc) */
+    u_int8_t hlen;                           /* length of hardware address (of this machine) */
+    u_int8_t hops;                           /* hops */
+    u_int32_t xid;                           /* random transaction id number - chosen by this machine */
+    u_int16_t secs;                          /* seconds used in timing */
+    u_int16_t flags;                         /* flags */
+    struct in_addr ciaddr;                   /* IP address of this machine (if we already have one) */
+    struct in_addr yiaddr;                   /* IP address of this machine (offered by the DHCP server) */
+    struct in_addr siaddr;                   /* IP address of DHCP server */
+    struct in_addr giaddr;                   /* IP address of DHCP relay */
+    unsigned char chaddr[MAX_CHADDR_LENGTH]; /* hardware address of this machine */
+    char sname[MAX_SNAME_LENGTH];            /* name of DHCP server */
+    char file[MAX_FILE_LENGTH];              /* boot file name (used for disk-less booting?) */
+    char options[MAX_OPTIONS_LENGTH];        /* options */
+};
+typedef struct DHCP_packet DHCP_packet;
+
+#define BOOT_REQUEST 1
+#define BOOT_REPLY   2
+
+#define DHCP_DISCOVER 1
+#define DHCP_OFFER    2
+#define DHCP_REQUEST  3
+#define DHCP_ACK      5
+#define DHCP_NACK     6
+#define DHCP_RELEASE  7
+
+#define BROADCAST_FLAG 0x8000
+
+#define CLIENT_PORT 68
+
+#define HTYPE 1
+#define HLEN  6
+
+#define OPTION_PAD                       0
+#define OPTION_DEFAULT_GATEWAY_ROUTER_ID 3
+#define OPTION_DNS_SERVER_ID             6
+#define OPTION_ADDRESS_REQUEST           50
+#define OPTION_LEASE_TIME                51
+#define OPTION_MESSAGE_TYPE              53
+#define OPTION_SERVER_ID                 54
+#define OPTION_RENEWAL_TIME              58
+#define OPTION_REBINDING_TIME            59
+#define OPTION_RELAY_AGENT               82
+#define OPTION_END                       255
+
+#define DHCP_FIXED_LENGTH  offsetof(DHCP_packet, options)
+#define DHCP_COOKIE_LENGTH 4
+#define DHCP_MIN_LENGTH    300       /* BOOTP minimum, shorter packets are padded */
+
+/* Space an option with data_length bytes of data takes, for declaring layouts. */
+#define DHCP_OPTION_SIZE(data_length) (2 + (data_length))
+
+/* Bytes to send for a packet whose options end (after OPTION_END) at options_length. */
+#define DHCP_PACKET_LENGTH(options_length) \
+    (DHCP_FIXED_LENGTH + (options_length) > DHCP_MIN_LENGTH ? DHCP_FIXED_LENGTH + (options_length) : DHCP_MIN_LENGTH)
+
+#define DHCP_CHECK_LAYOUT(options_length) \
+    _Static_assert((options_length) <= MAX_OPTIONS_LENGTH, "DHCP options do not fit in the packet")
+
+static inline void set_magic_cookie(DHCP_packet *packet) {
+    packet->options[0] = '\x63';
+    packet->options[1] = '\x82';
+    packet->options[2] = '\x53';
+    packet->options[3] = '\x63';
+}
+
+static inline int has_magic_cookie(const DHCP_packet *packet) {
+    return memcmp(packet->options, "\x63\x82\x53\x63", DHCP_COOKIE_LENGTH) == 0;
+}
+
+static inline void dhcp_put_u8(DHCP_packet *packet, int offset, u_int8_t code, u_int8_t value) {
+    unsigned char *option = (unsigned char *) packet->options + offset;
+    option[0] = code;
+    option[1] = 1;
+    option[2] = value;
+}
+
+/* value in host byte order, written in network byte order */
+static inline void dhcp_put_u32(DHCP_packet *packet, int offset, u_int8_t code, u_int32_t value) {
+    unsigned char *option = (unsigned char *) packet->options + offset;
+    option[0] = code;
+    option[1] = 4;
+    value = htonl(value);
+    memcpy(option + 2, &value, 4);
+}
+
+static inline void dhcp_put_address(DHCP_packet *packet, int offset, u_int8_t code, struct in_addr addr) {
+    unsigned char *option = (unsigned char *) packet->options + offset;
+    option[0] = code;
+    option[1] = 4;
+    memcpy(option + 2, &addr.s_addr, 4);
+}
+
+static inline void dhcp_put_bytes(DHCP_packet *packet, int offset, u_int8_t code, const void *data,
+                                  u_int8_t length) {
+    unsigned char *option = (unsigned char *) packet->options + offset;
+    option[0] = code;
+    option[1] = length;
+    memcpy(option + 2, data, length);
+}
+
+/*
+ * Write OPTION_END at end_offset and zero the BOOTP padding after it. Returns
+ * the number of bytes to send.
+ */
+static inline size_t dhcp_finish(DHCP_packet *packet, int end_offset) {
+    packet->options[end_offset] = (char) OPTION_END;
+    size_t length = DHCP_PACKET_LENGTH(end_offset + 1);
+    size_t used = DHCP_FIXED_LENGTH + end_offset + 1;
+    if (length > used) memset((char *) packet + used, 0, length - used);
+    return length;
+}
+
+/*
+ * Find option code in a received packet. Returns a pointer to its code byte
+ * (length at [1], data from [2]) or NULL. Every access is bounds checked, so
+ * a truncated or malformed option list simply ends the search.
+ */
+static inline const unsigned char *dhcp_find_option(const DHCP_packet *packet, u_int8_t code) {
+    const unsigned char *options = (const unsigned char *) packet->options;
+    size_t i = DHCP_COOKIE_LENGTH;
+    while (i < MAX_OPTIONS_LENGTH) {
+        if (options[i] == OPTION_END) return NULL;
+        if (options[i] == OPTION_PAD) {
+            i++;
+            continue;
+        }
+        if (i + 1 >= MAX_OPTIONS_LENGTH || i + 2 + options[i + 1] > MAX_OPTIONS_LENGTH) return NULL;
+        if (options[i] == code) return options + i;
+        i += 2 + options[i + 1];
+    }
+    return NULL;
+}
+
+/* Option 53, or 0 if it is missing. */
+static inline int dhcp_message_type(const DHCP_packet *packet) {
+    const unsigned char *option = dhcp_find_option(packet, OPTION_MESSAGE_TYPE);
+    return option && option[1] >= 1 ? option[2] : 0;
+}
+
+/* First address of an address option. ERROR (-1) if it is missing or too short. */
+static inline int dhcp_get_address(const DHCP_packet *packet, u_int8_t code, struct in_addr *addr) {
+    const unsigned char *option = dhcp_find_option(packet, code);
+    if (option == NULL || option[1] < 4) return -1;
+    memcpy(&addr->s_addr, option + 2, 4);
+    return 0;
+}
+
+/* A 32-bit option in host byte order. ERROR (-1) if it is missing or too short. */
+static inline int dhcp_get_u32(const DHCP_packet *packet, u_int8_t code, u_int32_t *value) {
+    const unsigned char *option = dhcp_find_option(packet, code);
+    if (option == NULL || option[1] < 4) return -1;
+    memcpy(value, option + 2, 4);
+    *value = ntohl(*value);
+    return 0;
+}
+
+#endif
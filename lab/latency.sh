@@ -0,0 +1,162 @@
+#!/bin/bash
+# Reply latency and CPU cost of the server with and without low-latency mode.
+#
+# Puts the server and one load generator in namespaces on a bridge, then for
+# each mode starts a fresh server and sends REQUESTs one at a time at a fixed
+# rate, timing every reply. The report holds, per mode, the round trip seen by
+# the client, the server's own receive-to-send latency and the CPU time the
+# server used, so the two can be weighed against each other per deployment.
+#
+# usage: sudo ./latency.sh [-i interface] [-n requests] [-r per second] [-c cpu] [-o report.json]
+#   -i  name of the link inside every namespace (enp0s3)
+#   -n  requests per mode (5000)
+#   -r  requests per second (500)
+#   -c  core the low-latency server is pinned to (the last one)
+#   -o  report path (latency.json)
+
+set -u
+
+INTERFACE=enp0s3
+REQUESTS=5000
+RATE=500
+CPU=$(($(nproc) - 1))
+REPORT=latency.json
+
+while getopts "i:n:r:c:o:" option; do
+    case $option in
+        i) INTERFACE=$OPTARG ;;
+        n) REQUESTS=$OPTARG ;;
+        r) RATE=$OPTARG ;;
+        c) CPU=$OPTARG ;;
+        o) REPORT=$OPTARG ;;
+        *) sed -n '2,15p' "$0"; exit 1 ;;
+    esac
+done
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d /tmp/dhcp-latency.XXXXXX)
+BRIDGE=dl-br0
+SUBNET=10.0.2
+SERVER_IP=$SUBNET.15
+NAMESPACES="dl-srv dl-c1"
+
+teardown() {
+    for pid in $(jobs -p); do kill "$pid" 2>/dev/null; done
+    wait 2>/dev/null
+    for ns in $NAMESPACES; do ip netns del "$ns" 2>/dev/null; done
+    ip link del "$BRIDGE" 2>/dev/null
+}
+
+add_host() {
+    ip netns add "$1"
+    ip link add "v$1" type veth peer name "$INTERFACE" netns "$1"
+    ip link set "v$1" master "$BRIDGE" up
+    ip -n "$1" link set lo up
+    ip -n "$1" link set "$INTERFACE" up
+    ip -n "$1" addr add "$2/24" dev "$INTERFACE"
+}
+
+query() {
+    python3 - "$WORK/query.sock" "$1" <<'EOF'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.argv[2].encode() + b"\n")
+print(s.makefile().readline().strip())
+EOF
+}
+
+stat_value() { echo "$1" | tr ' ' '\n' | sed -n "s/^$2=//p"; }
+
+# one REQUEST in flight at a time, prints {"p50_us":..,"p99_us":..,"lost":..}
+drive() {
+    ip netns exec dl-c1 python3 - "$INTERFACE" "$SERVER_IP" "$REQUESTS" "$RATE" <<'EOF'
+import select, socket, struct, sys, time
+interface, server, requests, rate = sys.argv[1], sys.argv[2], int(sys.argv[3]), int(sys.argv[4])
+pool = [int(o) for o in server.split(".")[:3]]
+s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+s.setsockopt(socket.SOL_SOCKET, socket.SO_BINDTODEVICE, interface.encode())
+s.bind(("0.0.0.0", 68))
+rtts, lost = [], 0
+start = time.perf_counter()
+for n in range(requests):
+    host = n % 16
+    chaddr = bytes([0x02, 0x4c, 0x41, 0x54, 0, host]) + bytes(10)
+    packet = struct.pack("!BBBBIHH16s16s64s128s", 1, 1, 6, 0, n + 1, 0, 0x8000, bytes(16), chaddr, bytes(64), bytes(128))
+    packet += bytes([99, 130, 83, 99, 53, 1, 3, 50, 4] + pool + [120 + host, 255])
+    while time.perf_counter() < start + n / rate:
+        pass
+    sent = time.perf_counter()
+    s.sendto(packet, ("255.255.255.255", 66))
+    while True:
+        ready, _, _ = select.select([s], [], [], 0.1)
+        if not ready:
+            lost += 1
+            break
+        reply = s.recv(2048)
+        if reply[0] == 2 and struct.unpack("!I", reply[4:8])[0] == n + 1:
+            rtts.append((time.perf_counter() - sent) * 1e6)
+            break
+rtts.sort()
+pick = lambda f: int(rtts[min(len(rtts) - 1, int(len(rtts) * f))]) if rtts else None
+print('{"p50_us":%s,"p99_us":%s,"lost":%d}' % (pick(0.5), pick(0.99), lost))
+EOF
+}
+
+# mode name, extra config lines; prints the mode's JSON object
+run_mode() {
+    cat > "$WORK/$1.conf" <<EOF
+interface $INTERFACE
+pool_start 120
+pool_end 150
+query_socket $WORK/query.sock
+$2
+EOF
+    rm -f "$WORK/query.sock"
+    ip netns exec dl-srv stdbuf -oL "$WORK/server" "$WORK/$1.conf" > "$WORK/$1.log" 2>&1 &
+    local pid=$!
+    for _ in $(seq 50); do [ -S "$WORK/query.sock" ] && break; sleep 0.1; done
+    local idle client stats
+    idle=$(query stats)
+    client=$(drive)
+    stats=$(query stats)
+    kill $pid 2>/dev/null
+    wait $pid 2>/dev/null
+
+    local cpu=$(($(stat_value "$stats" cpu_user_ms) + $(stat_value "$stats" cpu_system_ms) -
+                 $(stat_value "$idle" cpu_user_ms) - $(stat_value "$idle" cpu_system_ms)))
+    echo "\"$1\": {\"client_rtt\": $client, \"server_p50_us\": $(stat_value "$stats" dhcp_p50_us)," \
+         "\"server_p99_us\": $(stat_value "$stats" dhcp_p99_us), \"server_cpu_ms\": $cpu}"
+}
+
+[ "$(id -u)" = 0 ] || { echo "run as root"; exit 1; }
+trap teardown EXIT
+teardown
+gcc -O2 -o "$WORK/server" "$REPO"/DHCP_server/*.c -lpthread -lm || { echo "build failed"; exit 1; }
+ip link add "$BRIDGE" type bridge || { echo "could not create the namespaces"; exit 1; }
+ip link set "$BRIDGE" up
+add_host dl-srv "$SERVER_IP"
+add_host dl-c1 "$SUBNET.50"
+
+echo "normal mode: $REQUESTS requests at $RATE/s"
+NORMAL=$(run_mode normal "")
+# spinning for two request intervals keeps the server awake between requests at this rate
+echo "low-latency mode on CPU $CPU"
+LOW=$(run_mode low_latency "pin_cpu $CPU
+busy_poll 50
+spin_time $((2000000 / RATE))")
+
+cat > "$REPORT" <<EOF
+{
+  "interface": "$INTERFACE",
+  "requests": $REQUESTS,
+  "rate": $RATE,
+  "cpus": $(nproc),
+  $NORMAL,
+  $LOW,
+  "logs": "$WORK"
+}
+EOF
+echo "report written to $REPORT, logs in $WORK"
@@ -0,0 +1,96 @@
+#include <arpa/inet.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../DHCP_server/lease.h"
+
+#define OK 0
+#define ERROR -1
+
+/*
+ * Lab helper: memory and sweep cost of the lease table at a given size. For
+ * every count on the command line a fresh process fills a table of exactly
+ * that many leases with distinct hardware addresses and addresses, then walks
+ * it the way the expiry sweep does, and prints the bytes the table committed
+ * per lease, the process's resident set and the sweep time.
+ *
+ * usage: ./leasebench [leases...]   (1000000 10000000)
+ */
+
+static double seconds_since(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (double) (now.tv_sec - start->tv_sec) + (double) (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static long resident_bytes(void) {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == NULL) return 0;
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+static int measure(u_int32_t leases) {
+    long baseline = resident_bytes();
+    if (lease_table_init(leases) == ERROR) {
+        printf("Could not reserve %u leases\n", leases);
+        return ERROR;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    unsigned char chaddr[LEASE_HLEN] = {0x02, 0x4c};
+    for (u_int32_t i = 0; i < leases; i++) {
+        memcpy(chaddr + 2, &i, sizeof(i));
+        struct in_addr addr = {htonl(0x0A000000 + i)};
+        if (lease_update(chaddr, addr, i) == NULL) {
+            printf("The table filled up after %u leases\n", i);
+            return ERROR;
+        }
+    }
+    double fill = seconds_since(&start);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    u_int32_t index = 0, expired = 0, now = leases / 2;
+    struct lease *lease;
+    while ((lease = lease_next(&index)) != NULL) expired += lease->expiry <= now;
+    double sweep = seconds_since(&start);
+
+    char table[64];
+    lease_format(table, sizeof(table));
+    size_t bytes = strtoul(strstr(table, "lease_bytes=") + strlen("lease_bytes="), NULL, 10);
+    long resident = resident_bytes() - baseline;
+    printf("{\"leases\": %u, \"bytes_per_lease\": %.1f, \"rss_bytes_per_lease\": %.1f, \"rss_mb\": %.1f,"
+           " \"fill_ns_per_lease\": %.0f, \"sweep_ms\": %.1f, \"expired\": %u}\n",
+           leases, (double) bytes / leases, (double) resident / leases, resident / 1048576.0,
+           fill * 1e9 / leases, sweep * 1e3, expired);
+    return OK;
+}
+
+int main(int argc, char *argv[]) {
+    const char *defaults[] = {"1000000", "10000000"};
+    const char **counts = argc > 1 ? (const char **) argv + 1 : defaults;
+    int total = argc > 1 ? argc - 1 : 2;
+
+    for (int i = 0; i < total; i++) {
+        long leases = strtol(counts[i], NULL, 10);
+        if (leases <= 0 || leases > MAX_LEASE_LIMIT) {
+            printf("Lease count must be between 1 and %d\n", MAX_LEASE_LIMIT);
+            exit(EXIT_FAILURE);
+        }
+        fflush(stdout);
+        pid_t child = fork();
+        if (child == 0) exit(measure((u_int32_t) leases) == OK ? EXIT_SUCCESS : EXIT_FAILURE);
+        int status;
+        if (child < 0 || waitpid(child, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+            exit(EXIT_FAILURE);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,85 @@
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "../DHCP_server/bpf_asm.h"
+
+#define OK 0
+#define ERROR -1
+
+/*
+ * Lab helper: rewrite the UDP destination port of frames arriving on an
+ * interface, so the attack tools (built for port 67) and the lab server (port
+ * 66) meet without changing either. The UDP checksum is patched incrementally
+ * (RFC 1624). Stays attached until it is killed.
+ */
+
+enum label {
+    LABEL_PASS,
+    LABEL_CHECKSUM_DONE
+};
+
+void assemble(struct bpf_asm *a, in_port_t from, in_port_t to) {
+    bpf_asm_init(a);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, 6, 1, offsetof(struct xdp_md, data), 0);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, 8, 1, offsetof(struct xdp_md, data_end), 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, 6, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, ETH_HLEN + 28);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 2, 8, 0, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, 6, 12, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(ETH_P_IP), LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, 6, ETH_HLEN, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 0x45, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, 6, ETH_HLEN + 9, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, IPPROTO_UDP, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, 6, ETH_HLEN + 22, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(from), LABEL_PASS);
+    bpf_asm_emit(a, BPF_ST | BPF_H | BPF_MEM, 6, 0, ETH_HLEN + 22, htons(to));
+
+    /* checksum = ~(~checksum + ~from + to), unless the sender left it out */
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, 6, ETH_HLEN + 26, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, 3, 0, 0, LABEL_PASS);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_XOR | BPF_K, 3, 0, 0, 0xFFFF);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, (u_int16_t) ~htons(from));
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 3, 0, 0, htons(to));
+    for (int fold = 0; fold < 2; fold++) {
+        bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 4, 3, 0, 0);
+        bpf_asm_emit(a, BPF_ALU64 | BPF_RSH | BPF_K, 4, 0, 0, 16);
+        bpf_asm_emit(a, BPF_ALU64 | BPF_AND | BPF_K, 3, 0, 0, 0xFFFF);
+        bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_X, 3, 4, 0, 0);
+    }
+    bpf_asm_emit(a, BPF_ALU64 | BPF_XOR | BPF_K, 3, 0, 0, 0xFFFF);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 0, LABEL_CHECKSUM_DONE);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 3, 0, 0, 0xFFFF);     /* 0 means no checksum */
+    bpf_asm_place(a, LABEL_CHECKSUM_DONE);
+    bpf_asm_emit(a, BPF_STX | BPF_H | BPF_MEM, 6, 3, ETH_HLEN + 26, 0);
+
+    bpf_asm_place(a, LABEL_PASS);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+    bpf_asm_emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc != 4) {
+        printf("Usage: %s interface from-port to-port\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    int from = atoi(argv[2]), to = atoi(argv[3]);
+    if (from <= 0 || from > 65535 || to <= 0 || to > 65535) {
+        printf("Invalid port\n");
+        exit(EXIT_FAILURE);
+    }
+
+    static struct bpf_asm program;
+    assemble(&program, (in_port_t) from, (in_port_t) to);
+    int program_fd = bpf_asm_load_xdp(&program);
+    if (program_fd < 0 || bpf_attach_xdp(program_fd, argv[1]) == ERROR) exit(EXIT_FAILURE);
+    fflush(stdout);
+
+    while (1) pause();
+    return 0;
+}
@@ -0,0 +1,315 @@
+#!/bin/bash
+# Namespace lab for the DHCP programs on one Linux box.
+#
+# Builds the server, client, attack tools and rogue monitor, puts each in its
+# own network namespace on a bridge, and runs them unmodified:
+#   1. baseline: legitimate clients, one after the other, against the server
+#   2. attack:   starvation (attacker.c) or a rogue server (fake.c)
+#   3. recovery: the same legitimate clients again, once the attack is stopped
+#   4. renewal:  one client holding a short lease, to check that it is extended
+#   5. reclaim:  after a starvation attack, wait for its leases to run out and
+#                start it again, to check that the pool is handed out anew
+# It records how long each client's exchange took from its first message to the
+# ACK, read from the client's trace (a DORA in the baseline, an INIT-REBOOT of
+# the kept lease in recovery), pool occupancy before and after the attack, and
+# how long the server's flood detector or the rogue monitor took to fire, then
+# writes a JSON report.
+#
+# usage: sudo ./run.sh [-i interface] [-c clients] [-a starve|rogue|none] [-t seconds] [-o report.json]
+#   -i  name of the link inside every namespace (enp0s3). The attack tools bind
+#       to enp0s3 by name, so any other name needs -a none.
+#   -c  legitimate clients per phase (3)
+#   -a  attack to run (starve)
+#   -t  seconds to let the attack run before measuring (5)
+#   -o  report path (report.json)
+#
+# The attack tools talk to port 67 and the lab server listens on 66; portmap
+# rewrites the port in XDP on the attacker's link instead of editing either.
+
+set -u
+
+INTERFACE=enp0s3
+CLIENTS=3
+ATTACK=starve
+ATTACK_TIME=5
+REPORT=report.json
+
+while getopts "i:c:a:t:o:" option; do
+    case $option in
+        i) INTERFACE=$OPTARG ;;
+        c) CLIENTS=$OPTARG ;;
+        a) ATTACK=$OPTARG ;;
+        t) ATTACK_TIME=$OPTARG ;;
+        o) REPORT=$OPTARG ;;
+        *) sed -n '2,27p' "$0"; exit 1 ;;
+    esac
+done
+case $ATTACK in starve|rogue|none) ;; *) echo "unknown attack $ATTACK"; exit 1 ;; esac
+if [ "$INTERFACE" != enp0s3 ] && [ "$ATTACK" != none ]; then
+    echo "the attack tools only bind to enp0s3, use -a none with -i $INTERFACE"
+    exit 1
+fi
+
+REPO=$(cd "$(dirname "$0")/.." && pwd)
+WORK=$(mktemp -d /tmp/dhcp-lab.XXXXXX)
+BRIDGE=dl-br0
+SUBNET=10.0.2
+SERVER_IP=$SUBNET.15
+ATTACKER_IP=$SUBNET.66
+MONITOR_IP=$SUBNET.5
+POOL_START=120
+POOL_END=150
+LEASE_TIME=20                        # short enough for the reclaim phase to wait out the attack's leases
+RENEW_LEASE=4
+NAMESPACES="dl-srv dl-att dl-mon"
+for i in $(seq 1 "$CLIENTS"); do NAMESPACES="$NAMESPACES dl-c$i"; done
+
+now_ms() { echo $(($(date +%s%N) / 1000000)); }
+
+# prefix every line with the time it was read, in milliseconds
+stamp() { while IFS= read -r line; do echo "$(now_ms) $line"; done; }
+
+teardown() {
+    for pid in $(jobs -p); do kill "$pid" 2>/dev/null; done
+    wait 2>/dev/null
+    for ns in $NAMESPACES; do ip netns del "$ns" 2>/dev/null; done
+    ip link del "$BRIDGE" 2>/dev/null
+}
+
+build() {
+    gcc -O2 -o "$WORK/server" "$REPO"/DHCP_server/*.c -lpthread -lm &&
+    gcc -O2 -o "$WORK/client" "$REPO/client/client.c" "$REPO/client/dhcp_client.c" &&
+    gcc -O2 -o "$WORK/attack" "$REPO/attacker/attacker_client/attacker.c" &&
+    gcc -O2 -o "$WORK/fake" "$REPO/attacker/fake_server/fake.c" &&
+    gcc -O2 -o "$WORK/monitor" "$REPO/monitor/monitor.c" "$REPO/DHCP_server/ring.c" &&
+    gcc -O2 -o "$WORK/portmap" "$REPO/lab/portmap.c" "$REPO/DHCP_server/bpf_asm.c"
+}
+
+# namespace, address: a veth named $INTERFACE inside, dl-<namespace> on the bridge
+add_host() {
+    ip netns add "$1"
+    ip link add "v$1" type veth peer name "$INTERFACE" netns "$1"
+    ip link set "v$1" master "$BRIDGE" up
+    ip -n "$1" link set lo up
+    ip -n "$1" link set "$INTERFACE" up
+    ip -n "$1" addr add "$2/24" dev "$INTERFACE"
+}
+
+setup() {
+    ip link add "$BRIDGE" type bridge || return 1
+    ip link set "$BRIDGE" up
+    add_host dl-srv "$SERVER_IP"
+    add_host dl-att "$ATTACKER_IP"
+    add_host dl-mon "$MONITOR_IP"
+    for i in $(seq 1 "$CLIENTS"); do add_host "dl-c$i" "$SUBNET.$((49 + i))"; done
+}
+
+query() {
+    python3 - "$WORK/query.sock" "$1" <<'EOF'
+import socket, sys
+s = socket.socket(socket.AF_UNIX)
+s.connect(sys.argv[1])
+s.sendall(sys.argv[2].encode() + b"\n")
+print(s.makefile().readline().strip())
+EOF
+}
+
+stat_value() { query stats | tr ' ' '\n' | sed -n "s/^$1=//p"; }
+
+pool_in_use() {
+    local used=0
+    for host in $(seq $POOL_START $POOL_END); do
+        set -- $(query "ip $SUBNET.$host")
+        [ "$1" != none ] && [ "${3:-0}" -gt 0 ] && used=$((used + 1))
+    done
+    echo $used
+}
+
+# the exchange that bound the client, from its trace: prints its kind (dora or
+# init-reboot) and the ms from its first message to the ACK, or nothing
+settled_exchange() {
+    sed -n 's/.*"xid":"\([^"]*\)","event":"\([a-z]*\)","t_us":\([0-9]*\).*/\1 \2 \3/p' "$1" 2>/dev/null | awk '
+        !($1 in first) { first[$1] = $2 }
+        $2 == "ack" { kind = first[$1]; us = $3 }
+        END { if (kind != "") printf "%s %.1f\n", kind == "reboot" ? "init-reboot" : "dora", us / 1000 }'
+}
+
+# run the legitimate clients of a phase one by one, each keeps its lease file across phases
+# so the recovery round reboots into the baseline lease; prints a JSON array of
+# {"exchange":..,"exchange_ms":..,"process_ms":..,"ok":..,"gateway":..}, where process_ms
+# is the client's whole run, start-up and exit included
+run_clients() {
+    local results=""
+    for i in $(seq 1 "$CLIENTS"); do
+        local start end gateway trace="$WORK/c$i.$1.trace"
+        start=$(now_ms)
+        gateway=$(ip netns exec "dl-c$i" timeout 15 "$WORK/client" -i "$INTERFACE" -t 10 -f "$WORK/c$i.lease" \
+                  -s "$SERVER_IP" -T "$trace" </dev/null 2>/dev/null | sed -n 's/^Default Gateway is: //p')
+        end=$(now_ms)
+        local ok=false
+        [ -n "$gateway" ] && [ "$gateway" != 0.0.0.0 ] && ok=true
+        local kind=null exchange_ms=null
+        set -- "$1" $(settled_exchange "$trace")
+        [ $# = 3 ] && { kind="\"$2\""; exchange_ms=$3; }
+        results="$results${results:+,}{\"client\":$i,\"exchange\":$kind,\"exchange_ms\":$exchange_ms,"
+        results="$results\"process_ms\":$((end - start)),\"ok\":$ok,\"gateway\":\"${gateway:-none}\"}"
+    done
+    echo "[$results]"
+}
+
+# keep client 1 bound through several short leases, starting from a copy of its
+# lease so that a pool the attack left full does not matter, and count from its
+# trace the renewals the server extended and the times it had to start over with a DISCOVER;
+# prints {"lease_time":..,"renewals":..,"extended":..,"restarts":..}
+run_renewal() {
+    sed -i "s/^lease_time .*/lease_time $RENEW_LEASE/" "$WORK/server.conf"
+    kill -HUP $(ip netns pids dl-srv)
+    sleep 0.5
+    cp "$WORK/c1.lease" "$WORK/renewal.lease"
+    sleep $((RENEW_LEASE * 3)) | ip netns exec dl-c1 timeout $((RENEW_LEASE * 3 + 1)) "$WORK/client" -i "$INTERFACE" \
+        -t 10 -f "$WORK/renewal.lease" -s "$SERVER_IP" -T "$WORK/renewal.trace" > /dev/null 2>&1
+    sed -i "s/^lease_time .*/lease_time $LEASE_TIME/" "$WORK/server.conf"
+    kill -HUP $(ip netns pids dl-srv)
+    sed -n 's/.*"xid":"\([^"]*\)","event":"\([a-z]*\)".*/\1 \2/p' "$WORK/renewal.trace" | awk -v lease="$RENEW_LEASE" '
+        !($1 in first) { first[$1] = $2 }
+        $2 == "ack" { acked[$1] = 1 }
+        END {
+            for (xid in first) {
+                if (first[xid] == "renew" || first[xid] == "rebind") { renewals++; extended += (xid in acked) }
+                else if (first[xid] == "discover") restarts++
+            }
+            printf "{\"lease_time\":%d,\"renewals\":%d,\"extended\":%d,\"restarts\":%d}\n",
+                   lease, renewals, extended, restarts
+        }'
+}
+
+# once every lease of the starvation attack has run out, run it again: its new
+# hardware addresses only get addresses if the server takes expired ones back,
+# the whole pool having been handed out; prints {"in_use_after_expiry":..,"in_use_after_second_attack":..}
+run_reclaim() {
+    local left=$((ATTACK_START + (ATTACK_TIME + LEASE_TIME + 1) * 1000 - $(now_ms)))
+    [ $left -gt 0 ] && sleep $((left / 1000 + 1))
+    local expired portmap
+    expired=$(pool_in_use)
+    "$WORK/portmap" "vdl-att" 67 66 > "$WORK/portmap.reclaim.log" 2>&1 &
+    portmap=$!
+    sleep 0.5
+    ip netns exec dl-att timeout "$ATTACK_TIME" "$WORK/attack" > "$WORK/attack.reclaim.log" 2>&1
+    kill $portmap 2>/dev/null
+    wait $portmap 2>/dev/null
+    echo "{\"in_use_after_expiry\":$expired,\"in_use_after_second_attack\":$(pool_in_use)}"
+}
+
+# first timestamp of a line matching pattern in file, waiting up to seconds
+wait_for_line() {
+    local deadline=$(($(now_ms) + $3 * 1000))
+    while [ "$(now_ms)" -lt $deadline ]; do
+        local hit
+        hit=$(grep -m1 "$2" "$1" 2>/dev/null | cut -d' ' -f1)
+        [ -n "$hit" ] && { echo "$hit"; return 0; }
+        sleep 0.02
+    done
+    return 1
+}
+
+wait_for_alert() {
+    local deadline=$(($(now_ms) + $1 * 1000))
+    while [ "$(now_ms)" -lt $deadline ]; do
+        [ "$(stat_value flood_alerts)" != 0 ] && { now_ms; return 0; }
+        sleep 0.02
+    done
+    return 1
+}
+
+[ "$(id -u)" = 0 ] || { echo "run as root"; exit 1; }
+trap teardown EXIT
+teardown
+build || { echo "build failed"; exit 1; }
+setup || { echo "could not create the namespaces"; exit 1; }
+
+cat > "$WORK/server.conf" <<EOF
+interface $INTERFACE
+pool_start $POOL_START
+pool_end $POOL_END
+lease_time $LEASE_TIME
+query_socket $WORK/query.sock
+EOF
+ip netns exec dl-srv stdbuf -oL "$WORK/server" "$WORK/server.conf" 2>&1 | stamp > "$WORK/server.log" &
+ip netns exec dl-mon stdbuf -oL "$WORK/monitor" "$INTERFACE" "$SERVER_IP" 2>&1 | stamp > "$WORK/monitor.log" &
+for _ in $(seq 50); do [ -S "$WORK/query.sock" ] && break; sleep 0.1; done
+[ -S "$WORK/query.sock" ] || { echo "server did not start, see $WORK/server.log"; exit 1; }
+
+echo "baseline: $CLIENTS clients"
+BASELINE=$(run_clients baseline)
+POOL_BEFORE=$(pool_in_use)
+
+DETECTED=false
+DETECT_MS=null
+DETAIL=null
+if [ "$ATTACK" != none ]; then
+    echo "attack: $ATTACK for $ATTACK_TIME s"
+    ATTACK_START=$(now_ms)
+    if [ "$ATTACK" = starve ]; then
+        "$WORK/portmap" "vdl-att" 67 66 > "$WORK/portmap.log" 2>&1 &
+        ATTACK_PIDS=$!
+        sleep 0.5
+        ATTACK_START=$(now_ms)
+        ip netns exec dl-att timeout "$ATTACK_TIME" "$WORK/attack" > "$WORK/attack.log" 2>&1 &
+        if ALERT=$(wait_for_alert "$ATTACK_TIME"); then
+            DETECTED=true
+            DETECT_MS=$((ALERT - ATTACK_START))
+            DETAIL="{\"server_detect_ms\":$(stat_value flood_detect_ms),\"new_addresses\":$(stat_value flood_new)}"
+        fi
+    else
+        ip netns exec dl-att "$WORK/portmap" "$INTERFACE" 66 67 > "$WORK/portmap.log" 2>&1 &
+        ATTACK_PIDS=$!
+        sleep 0.5
+        ip netns exec dl-att stdbuf -oL "$WORK/fake" > "$WORK/fake.log" 2>&1 &
+        ATTACK_PIDS="$ATTACK_PIDS $!"
+        sleep 0.5
+        ATTACK_START=$(now_ms)
+        VICTIM=$(ip netns exec dl-c1 timeout 15 "$WORK/client" -i "$INTERFACE" -t 10 -f "$WORK/victim.lease" </dev/null 2>/dev/null |
+                 sed -n 's/^Default Gateway is: //p')
+        GUARDED=$(ip netns exec dl-c1 timeout 15 "$WORK/client" -i "$INTERFACE" -t 10 -f "$WORK/guarded.lease" -s "$SERVER_IP" \
+                  </dev/null 2>/dev/null | sed -n 's/^Default Gateway is: //p')
+        if SEEN=$(wait_for_line "$WORK/monitor.log" "Rogue DHCP reply" "$ATTACK_TIME"); then
+            DETECTED=true
+            DETECT_MS=$((SEEN - ATTACK_START))
+        fi
+        MONITOR_US=$(grep -m1 "Rogue DHCP reply" "$WORK/monitor.log" | sed -n 's/.*detected in \([0-9]*\) us.*/\1/p')
+        DETAIL="{\"monitor_latency_us\":${MONITOR_US:-null},\"victim_gateway\":\"${VICTIM:-none}\",\"rogue_won\":$([ "$VICTIM" = "$ATTACKER_IP" ] && echo true || echo false),\"trusting_client_gateway\":\"${GUARDED:-none}\"}"
+    fi
+    sleep "$ATTACK_TIME"
+    kill $ATTACK_PIDS 2>/dev/null
+fi
+POOL_AFTER=$(pool_in_use)
+
+echo "recovery: $CLIENTS clients"
+RECOVERY=$(run_clients recovery)
+
+echo "renewal: one client on a $RENEW_LEASE s lease"
+RENEWAL=$(run_renewal)
+
+RECLAIM=null
+if [ "$ATTACK" = starve ]; then
+    echo "reclaim: waiting out the attack's leases, then attacking again"
+    RECLAIM=$(run_reclaim)
+fi
+STATS=$(query stats)
+
+cat > "$REPORT" <<EOF
+{
+  "interface": "$INTERFACE",
+  "clients": $CLIENTS,
+  "attack": "$ATTACK",
+  "pool": {"size": $((POOL_END - POOL_START + 1)), "in_use_before_attack": $POOL_BEFORE, "in_use_after_attack": $POOL_AFTER},
+  "baseline": $BASELINE,
+  "detection": {"detected": $DETECTED, "time_to_detect_ms": $DETECT_MS, "detail": $DETAIL},
+  "recovery": $RECOVERY,
+  "renewal": $RENEWAL,
+  "reclaim": $RECLAIM,
+  "server_stats": "$STATS",
+  "logs": "$WORK"
+}
+EOF
+echo "report written to $REPORT, logs in $WORK"
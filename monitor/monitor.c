@@ -0,0 +1,138 @@
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "../common/dhcp.h"
+#include "../DHCP_server/ring.h"
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_SERVERS 256              /* power of two, allowed servers included */
+#define SUMMARY_INTERVAL 10          /* seconds between summaries while replies arrive */
+
+/*
+ * Passive rogue server monitor. Every BOOTREPLY to the client port is taken
+ * from a packet ring, so nothing is answered and nothing is missed at line
+ * rate. A reply whose server id (option 54, or the source address without
+ * one), router or DNS server is not on the allowlist given on the command
+ * line is reported the first time its server is seen.
+ */
+
+struct server_entry {
+    in_addr_t addr;
+    int used;                        /* 0 if the slot is free, a reply may well name 0.0.0.0 */
+    int allowed;
+    int reported;                    /* a rogue reply from it has been reported */
+    unsigned long replies;
+};
+
+struct server_entry servers[MAX_SERVERS];
+unsigned long untracked = 0;         /* replies from servers that did not fit in the table */
+unsigned long total_replies = 0, rogue_replies = 0, rogue_servers = 0;
+
+struct server_entry *find_server(in_addr_t addr, int insert) {
+    u_int32_t slot = (ntohl(addr) * 0x9E3779B1U) & (MAX_SERVERS - 1);
+    for (int probe = 0; probe < MAX_SERVERS; probe++) {
+        struct server_entry *entry = &servers[(slot + probe) & (MAX_SERVERS - 1)];
+        if (entry->used && entry->addr == addr) return entry;
+        if (!entry->used) {
+            if (!insert) return NULL;
+            entry->addr = addr;
+            entry->used = 1;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+int is_allowed(struct in_addr addr) {
+    struct server_entry *entry = find_server(addr.s_addr, 0);
+    return entry != NULL && entry->allowed;
+}
+
+long microseconds_since(const struct timespec *received) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);        /* ring timestamps use the wall clock */
+    return (now.tv_sec - received->tv_sec) * 1000000L + (now.tv_nsec - received->tv_nsec) / 1000;
+}
+
+void check_reply(const DHCP_packet *packet, struct in_addr source, const struct timespec *received) {
+    if (packet->op != BOOT_REPLY || !has_magic_cookie(packet)) return;
+    total_replies++;
+
+    struct in_addr server_id = source, router = {0}, dns = {0};
+    dhcp_get_address(packet, OPTION_SERVER_ID, &server_id);
+    int has_router = dhcp_get_address(packet, OPTION_DEFAULT_GATEWAY_ROUTER_ID, &router) == OK;
+    int has_dns = dhcp_get_address(packet, OPTION_DNS_SERVER_ID, &dns) == OK;
+
+    struct server_entry *server = find_server(server_id.s_addr, 1);
+    if (server == NULL) untracked++;
+    else server->replies++;
+
+    int rogue = (server == NULL || !server->allowed) || (has_router && !is_allowed(router)) ||
+                (has_dns && !is_allowed(dns));
+    if (!rogue) return;
+    rogue_replies++;
+    if (server == NULL || server->reported) return;     /* the summary still counts it */
+    server->reported = 1;
+
+    long latency = microseconds_since(received);
+    rogue_servers++;
+    printf("Rogue DHCP reply from %s", inet_ntoa(source));
+    printf(": server id %s", inet_ntoa(server_id));
+    printf(", router %s", has_router ? inet_ntoa(router) : "-");
+    printf(", DNS %s", has_dns ? inet_ntoa(dns) : "-");
+    printf(", offered %s to %02x:%02x:%02x:%02x:%02x:%02x, detected in %ld us\n", inet_ntoa(packet->yiaddr),
+           packet->chaddr[0], packet->chaddr[1], packet->chaddr[2], packet->chaddr[3], packet->chaddr[4],
+           packet->chaddr[5], latency);
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s interface allowed-address...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    for (int i = 2; i < argc; i++) {
+        struct in_addr addr;
+        if (!inet_aton(argv[i], &addr) || addr.s_addr == 0) {
+            printf("Invalid allowed address %s\n", argv[i]);
+            exit(EXIT_FAILURE);
+        }
+        find_server(addr.s_addr, 1)->allowed = 1;
+    }
+
+    int ring_fd = ring_open(argv[1], CLIENT_PORT);
+    if (ring_fd < 0) exit(EXIT_FAILURE);
+    printf("Watching DHCP replies on %s, %d allowed addresses\n", argv[1], argc - 2);
+    fflush(stdout);
+
+    time_t last_summary = time(NULL);
+    unsigned long summarized = 0;
+    while (1) {
+        DHCP_packet packet;
+        struct sockaddr_in source;
+        struct timespec received;
+        while (ring_next(&packet, sizeof(packet), &source, &received) == OK) {
+            check_reply(&packet, source.sin_addr, &received);
+        }
+
+        if (time(NULL) - last_summary >= SUMMARY_INTERVAL && total_replies != summarized) {
+            printf("Replies: %lu, rogue: %lu from %lu servers, untracked: %lu\n", total_replies, rogue_replies,
+                   rogue_servers, untracked);
+            fflush(stdout);
+            last_summary = time(NULL);
+            summarized = total_replies;
+        }
+
+        struct pollfd descriptor = {ring_fd, POLLIN, 0};
+        poll(&descriptor, 1, 1000);
+    }
+    return 0;
+}
@@ -0,0 +1,2 @@
+gcc -o monitor monitor.c ../DHCP_server/ring.c
+sudo ./monitor enp0s3 10.0.2.15
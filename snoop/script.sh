@@ -0,0 +1,2 @@
+gcc -o snoop snoop.c ../DHCP_server/bpf_asm.c ../DHCP_server/ring.c
+sudo ./snoop v-srv v-cli v-cli2
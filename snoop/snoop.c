@@ -0,0 +1,297 @@
+#include <arpa/inet.h>
+#include <net/ethernet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../common/dhcp.h"
+#include "../DHCP_server/bpf_asm.h"
+#include "../DHCP_server/reservation.h"
+#include "../DHCP_server/ring.h"
+
+#define OK 0
+#define ERROR -1
+
+#define MAX_BINDINGS 65536           /* power of two */
+#define AGING_SLICE (MAX_BINDINGS / 16)      /* slots checked for expiry per wakeup */
+#define POLL_TIMEOUT 100             /* milliseconds */
+#define SUMMARY_INTERVAL 10          /* seconds between summaries while something changes */
+#define DEFAULT_LEASE_TIME 120       /* seconds, for ACKs without option 51 */
+
+/*
+ * DHCP snooping with IP source guard for a Linux bridge. Bindings of hardware
+ * address to leased address are learned from ACKs arriving on the trusted
+ * port, the one facing the real server, through a packet ring. Each untrusted
+ * port gets an XDP program that drops
+ *   - anything sent to the client port, so replies only come from the trusted side,
+ *   - IPv4 whose source address is not the one bound to its source MAC,
+ * and lets through DHCP from clients that have no address yet and non-IPv4.
+ * Bindings age out with their lease.
+ */
+
+enum snoop_verdict {
+    SNOOP_PASSED_DHCP = 0,           /* client without an address talking to a server */
+    SNOOP_PASSED_BOUND,              /* source address matches the binding */
+    SNOOP_DROP_REPLY,                /* a DHCP reply from a client port */
+    SNOOP_DROP_UNBOUND,              /* source MAC has no binding */
+    SNOOP_DROP_SPOOFED,              /* source address is not the bound one */
+    SNOOP_VERDICT_COUNT
+};
+
+const char *verdict_names[SNOOP_VERDICT_COUNT] = {"dhcp", "bound", "reply", "unbound", "spoofed"};
+
+enum label {
+    LABEL_PASS,
+    LABEL_GUARD,
+    LABEL_DHCP,
+    LABEL_BOUND,
+    LABEL_REPLY,
+    LABEL_UNBOUND,
+    LABEL_SPOOFED,
+    LABEL_COUNT,
+    LABEL_EXIT
+};
+
+/* registers the program keeps */
+#define R_DATA     6
+#define R_VERDICT  7
+#define R_DATA_END 8
+#define R_SOURCE   9
+
+/* 16 bytes, four to a cache line; key 0 marks a free slot */
+struct binding {
+    u_int64_t key;                   /* reservation_key() of the hardware address */
+    in_addr_t addr;
+    u_int32_t expiry;                /* monotonic seconds */
+};
+
+struct binding bindings[MAX_BINDINGS];
+int binding_count = 0;
+u_int32_t aging_cursor = 0;
+
+int binding_map = -1;                /* hardware address (8 bytes, zero padded) to in_addr_t, for XDP */
+int counter_map = -1;
+
+u_int32_t now_seconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (u_int32_t) now.tv_sec;
+}
+
+u_int32_t home_slot(u_int64_t key) {
+    return (u_int32_t) reservation_hash(key, 0) & (MAX_BINDINGS - 1);
+}
+
+void map_key(u_int64_t key, unsigned char *map_key) {
+    memset(map_key, 0, 8);
+    for (int i = 0; i < ETH_ALEN; i++) map_key[i] = (unsigned char) (key >> (8 * (ETH_ALEN - 1 - i)));
+}
+
+struct binding *binding_find(u_int64_t key, int insert) {
+    for (u_int32_t slot = home_slot(key);; slot = (slot + 1) & (MAX_BINDINGS - 1)) {
+        struct binding *binding = &bindings[slot];
+        if (binding->key == key) return binding;
+        if (binding->key == 0) {
+            if (!insert || binding_count == MAX_BINDINGS - 1) return NULL;
+            binding->key = key;
+            binding_count++;
+            return binding;
+        }
+    }
+}
+
+/* Linear probing delete: pull later entries of the same run back so no tombstones are needed. */
+void binding_remove(u_int32_t slot) {
+    unsigned char key[8];
+    map_key(bindings[slot].key, key);
+    bpf_map_delete(binding_map, key);
+
+    u_int32_t hole = slot;
+    for (u_int32_t next = (slot + 1) & (MAX_BINDINGS - 1); bindings[next].key;
+         next = (next + 1) & (MAX_BINDINGS - 1)) {
+        u_int32_t home = home_slot(bindings[next].key);
+        /* the entry may move into the hole only if the hole lies between its home slot and it */
+        if (((next - home) & (MAX_BINDINGS - 1)) >= ((next - hole) & (MAX_BINDINGS - 1))) {
+            bindings[hole] = bindings[next];
+            hole = next;
+        }
+    }
+    bindings[hole].key = 0;
+    binding_count--;
+}
+
+void learn(const DHCP_packet *packet) {
+    if (packet->op != BOOT_REPLY || packet->hlen != ETH_ALEN || !has_magic_cookie(packet)) return;
+    int type = dhcp_message_type(packet);
+    u_int64_t key = reservation_key(packet->chaddr);
+    if (key == 0) return;
+
+    if (type == DHCP_NACK) {
+        struct binding *binding = binding_find(key, 0);
+        if (binding) binding_remove((u_int32_t) (binding - bindings));
+        return;
+    }
+    if (type != DHCP_ACK || packet->yiaddr.s_addr == 0) return;
+
+    u_int32_t lease_time = DEFAULT_LEASE_TIME;
+    dhcp_get_u32(packet, OPTION_LEASE_TIME, &lease_time);
+
+    struct binding *binding = binding_find(key, 1);
+    if (binding == NULL) {
+        printf("Binding table is full\n");
+        return;
+    }
+    binding->addr = packet->yiaddr.s_addr;
+    binding->expiry = now_seconds() + lease_time;
+
+    unsigned char map_key_bytes[8];
+    map_key(key, map_key_bytes);
+    bpf_map_update(binding_map, map_key_bytes, &binding->addr);
+
+    printf("Binding %02x:%02x:%02x:%02x:%02x:%02x -> %s for %u seconds\n", packet->chaddr[0], packet->chaddr[1],
+           packet->chaddr[2], packet->chaddr[3], packet->chaddr[4], packet->chaddr[5], inet_ntoa(packet->yiaddr),
+           lease_time);
+}
+
+/* Check the next slice of the table, so aging costs the same on every wakeup. */
+void age_bindings() {
+    u_int32_t now = now_seconds();
+    for (int checked = 0; checked < AGING_SLICE; checked++) {
+        struct binding *binding = &bindings[aging_cursor];
+        if (binding->key && (int32_t) (now - binding->expiry) >= 0) {
+            binding_remove(aging_cursor);
+            continue;                /* another entry may have moved into this slot */
+        }
+        aging_cursor = (aging_cursor + 1) & (MAX_BINDINGS - 1);
+    }
+}
+
+void verdict_block(struct bpf_asm *a, enum label label, enum snoop_verdict verdict) {
+    bpf_asm_place(a, label);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, R_VERDICT, 0, 0, verdict);
+    bpf_asm_jump(a, BPF_JMP | BPF_JA, 0, 0, 0, LABEL_COUNT);
+}
+
+void assemble(struct bpf_asm *a) {
+    bpf_asm_init(a);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, R_DATA, 1, offsetof(struct xdp_md, data), 0);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, R_DATA_END, 1, offsetof(struct xdp_md, data_end), 0);
+
+    /* only IPv4 is guarded */
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, R_DATA, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, ETH_HLEN + 20);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 2, R_DATA_END, 0, LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, 12, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(ETH_P_IP), LABEL_PASS);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, R_SOURCE, R_DATA, ETH_HLEN + 12, 0);
+
+    /* UDP with a plain header: replies are dropped, requests from 0.0.0.0 pass */
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, ETH_HLEN + 9, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, IPPROTO_UDP, LABEL_GUARD);
+    bpf_asm_emit(a, BPF_LDX | BPF_B | BPF_MEM, 3, R_DATA, ETH_HLEN, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, 0x45, LABEL_GUARD);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, R_DATA, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, ETH_HLEN + 28);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_X, 2, R_DATA_END, 0, LABEL_GUARD);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, ETH_HLEN + 22, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, 3, 0, htons(CLIENT_PORT), LABEL_REPLY);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, ETH_HLEN + 20, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_K, 3, 0, htons(CLIENT_PORT), LABEL_GUARD);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, R_SOURCE, 0, 0, LABEL_DHCP);
+
+    /* bindings[source MAC] == source address */
+    bpf_asm_place(a, LABEL_GUARD);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, 3, R_DATA, ETH_ALEN, 0);
+    bpf_asm_emit(a, BPF_STX | BPF_W | BPF_MEM, 10, 3, -8, 0);
+    bpf_asm_emit(a, BPF_LDX | BPF_H | BPF_MEM, 3, R_DATA, ETH_ALEN + 4, 0);
+    bpf_asm_emit(a, BPF_STX | BPF_H | BPF_MEM, 10, 3, -4, 0);
+    bpf_asm_emit(a, BPF_ST | BPF_H | BPF_MEM, 10, 0, -2, 0);
+    bpf_asm_load_map(a, 1, binding_map);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_X, 2, 10, 0, 0);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_ADD | BPF_K, 2, 0, 0, -8);
+    bpf_asm_emit(a, BPF_JMP | BPF_CALL, 0, 0, 0, BPF_FUNC_map_lookup_elem);
+    bpf_asm_jump(a, BPF_JMP | BPF_JEQ | BPF_K, 0, 0, 0, LABEL_UNBOUND);
+    bpf_asm_emit(a, BPF_LDX | BPF_W | BPF_MEM, 3, 0, 0, 0);
+    bpf_asm_jump(a, BPF_JMP | BPF_JNE | BPF_X, 3, R_SOURCE, 0, LABEL_SPOOFED);
+
+    verdict_block(a, LABEL_BOUND, SNOOP_PASSED_BOUND);
+    verdict_block(a, LABEL_DHCP, SNOOP_PASSED_DHCP);
+    verdict_block(a, LABEL_REPLY, SNOOP_DROP_REPLY);
+    verdict_block(a, LABEL_UNBOUND, SNOOP_DROP_UNBOUND);
+    verdict_block(a, LABEL_SPOOFED, SNOOP_DROP_SPOOFED);
+
+    bpf_asm_place(a, LABEL_COUNT);
+    bpf_asm_count(a, R_VERDICT, counter_map);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_DROP);
+    bpf_asm_jump(a, BPF_JMP | BPF_JGT | BPF_K, R_VERDICT, 0, SNOOP_PASSED_BOUND, LABEL_EXIT);
+
+    bpf_asm_place(a, LABEL_PASS);
+    bpf_asm_emit(a, BPF_ALU64 | BPF_MOV | BPF_K, 0, 0, 0, XDP_PASS);
+    bpf_asm_place(a, LABEL_EXIT);
+    bpf_asm_emit(a, BPF_JMP | BPF_EXIT, 0, 0, 0, 0);
+}
+
+void print_summary() {
+    printf("Bindings: %d", binding_count);
+    for (u_int32_t verdict = 0; verdict < SNOOP_VERDICT_COUNT; verdict++) {
+        printf(", %s %s %llu", verdict <= SNOOP_PASSED_BOUND ? "passed" : "dropped", verdict_names[verdict],
+               (unsigned long long) bpf_map_sum(counter_map, verdict));
+    }
+    puts("");
+    fflush(stdout);
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 3) {
+        printf("Usage: %s trusted-port untrusted-port...\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    binding_map = bpf_map_create(BPF_MAP_TYPE_HASH, 8, sizeof(in_addr_t), MAX_BINDINGS);
+    counter_map = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, sizeof(u_int32_t), sizeof(u_int64_t),
+                                 SNOOP_VERDICT_COUNT);
+    if (binding_map < 0 || counter_map < 0) exit(EXIT_FAILURE);
+
+    static struct bpf_asm program;
+    assemble(&program);
+    int program_fd = bpf_asm_load_xdp(&program);
+    if (program_fd < 0) exit(EXIT_FAILURE);
+    for (int i = 2; i < argc; i++) {
+        if (bpf_attach_xdp(program_fd, argv[i]) == ERROR) exit(EXIT_FAILURE);
+    }
+
+    int ring_fd = ring_open(argv[1], CLIENT_PORT);
+    if (ring_fd < 0) exit(EXIT_FAILURE);
+    printf("Learning bindings from %s, guarding %d ports\n", argv[1], argc - 2);
+    fflush(stdout);
+
+    time_t last_summary = time(NULL);
+    u_int64_t summarized = 0;
+    while (1) {
+        DHCP_packet packet;
+        struct sockaddr_in source;
+        struct timespec received;
+        while (ring_next(&packet, sizeof(packet), &source, &received) == OK) learn(&packet);
+        age_bindings();
+
+        if (time(NULL) - last_summary >= SUMMARY_INTERVAL) {
+            u_int64_t seen = binding_count;
+            for (u_int32_t verdict = 0; verdict < SNOOP_VERDICT_COUNT; verdict++) {
+                seen += bpf_map_sum(counter_map, verdict);
+            }
+            if (seen != summarized) print_summary();
+            summarized = seen;
+            last_summary = time(NULL);
+        }
+        fflush(stdout);
+
+        struct pollfd descriptor = {ring_fd, POLLIN, 0};
+        poll(&descriptor, 1, POLL_TIMEOUT);
+    }
+    return 0;
+}